@@ -27,6 +27,7 @@
 #include "utility/charset.h"
 #include "utility/strings.h"
 #include "utility/desktop.h"
+#include "utility/task_graph.h"
 #include "utility/logs.h"
 #if defined(HAVE_SDL2_IMAGE)
 #include <SDL_image.h>
@@ -84,12 +85,19 @@ Application::Application()
 {
     Log::i("Configuration directory: %s", get_configuration_dir().c_str());
 
-    std::unique_ptr<CSimpleIniA> ini = initialize_config();
+    std::unique_ptr<CSimpleIniA> ini;
+    {
+        Phase_Timer timer("configuration");
+        ini = initialize_config();
+    }
 
-    if (const char *value = ini->GetValue("", "theme"))
-        load_theme(value);
-    else
-        load_default_theme();
+    {
+        Phase_Timer timer("theme");
+        if (const char *value = ini->GetValue("", "theme"))
+            load_theme(value);
+        else
+            load_default_theme();
+    }
 
     if (const char *value = ini->GetValue("", "midi-out-device"))
         last_midi_output_choice_.assign(value);
@@ -125,14 +133,18 @@ Application::Application()
     if (const char *value = ini->GetValue("", "initial-path"))
         initial_path = make_path_canonical(expand_path_tilde(value));
 
-    if (!initial_path.empty())
-        fb->set_current_path(initial_path);
-    else {
-        std::string home = get_home_directory();
-        if (!home.empty())
-            fb->set_cwd(home);
+    {
+        Phase_Timer timer("file browser");
+        if (!initial_path.empty())
+            fb->set_current_path(initial_path);
+        else {
+            std::string home = get_home_directory();
+            if (!home.empty())
+                fb->set_cwd(home);
+        }
     }
 
+    // the player completes its initialization in its own thread
     Player *pl = new Player;
     player_.reset(pl);
 
@@ -145,21 +157,85 @@ Application::Application()
     if (update_timer_ == 0)
         throw std::runtime_error("SDL_AddTimer");
 
-    choose_midi_output(false, last_midi_output_choice_);
-    choose_synth(false, last_synth_choice_);
-
     for (size_t i = 0; i < Synth_Fx::Parameter_Count; ++i) {
         std::unique_ptr<Pcmd_Set_Fx_Parameter> cmd(new Pcmd_Set_Fx_Parameter);
         cmd->index = i;
         cmd->value = fx_parameters[i];
         pl->push_command(std::move(cmd));
     }
+
+    start_background_init();
+}
+
+void Application::start_background_init()
+{
+    Task_Graph *startup = new Task_Graph(2);
+    startup_.reset(startup);
+
+    startup_midi_outputs_.reset(new std::vector<Midi_Output>);
+
+    startup_plugins_task_ = startup->add_task(
+        "synth plugins", [] { Synth_Host::plugins(); });
+    startup_midi_task_ = startup->add_task(
+        "midi outputs", [this] { get_midi_outputs(*startup_midi_outputs_); });
+
+    startup->start();
+}
+
+void Application::advance_background_init()
+{
+    Task_Graph *startup = startup_.get();
+    if (!startup)
+        return;
+
+    if (!synth_online_ && startup->is_done(startup_plugins_task_)) {
+        resolve_default_synth();
+        choose_synth(false, last_synth_choice_);
+        synth_online_ = true;
+    }
+
+    if (!midi_online_ && startup->is_done(startup_midi_task_)) {
+        choose_midi_output(false, last_midi_output_choice_, *startup_midi_outputs_);
+        startup_midi_outputs_.reset();
+        midi_online_ = true;
+    }
+
+    if (synth_online_ && midi_online_) {
+        startup_.reset();
+        Log::i("Background initialization complete");
+    }
+}
+
+void Application::resolve_default_synth()
+{
+    std::unique_ptr<CSimpleIniA> ini = load_global_configuration();
+    if (!ini) ini = create_configuration();
+
+    if (ini->GetValue("", "synth-device"))
+        return;
+
+    const std::vector<Synth_Host::Plugin_Info> &plugins = Synth_Host::plugins();
+    const char *default_synth_name = nullptr;
+
+    for (size_t i = 0, n = plugins.size(); i < n && !default_synth_name; ++i) {
+        const Synth_Host::Plugin_Info &info = plugins[i];
+        if (info.id == default_synth_id)
+            default_synth_name = info.name.c_str();
+    }
+
+    ini->SetValue("", "synth-device", default_synth_name ? default_synth_name : "", "; Selected device for synthesis");
+    save_global_configuration(*ini);
+
+    last_synth_choice_.assign(default_synth_name ? default_synth_name : "");
 }
 
 Application::~Application()
 {
     if (update_timer_)
         SDL_RemoveTimer(update_timer_);
+
+    // the startup tasks write into members, finish them before these go
+    startup_.reset();
 }
 
 SDL_Window *Application::init_window()
@@ -248,6 +324,7 @@ void Application::exec()
         case SDL_USEREVENT:
             update = true;
             if (!shutting_down) {
+                advance_background_init();
                 request_update();
                 update_modals();
             }
@@ -388,7 +465,10 @@ void Application::paint_scaled(SDL_Renderer *rr, int paint, unsigned scale)
     if (paint & Pt_Foreground) {
         SDLpp_SaveClipState(rr, clip);
         SDL_RenderSetClipRect(rr, &lo.playing_value.bounds);
-        draw_text_rect(lo.playing_value, path_file_name(ps.file_path), pal[Colors::text_high_brightness]);
+        if (ps.file_path.empty() && !player_->is_audio_ready())
+            draw_text_rect(lo.playing_value, "Starting audio...", pal[Colors::text_low_brightness]);
+        else
+            draw_text_rect(lo.playing_value, path_file_name(ps.file_path), pal[Colors::text_high_brightness]);
         SDLpp_RestoreClipState(rr, clip);
     }
     if (paint & Pt_Background) {
@@ -813,19 +893,25 @@ bool Application::handle_key_pressed(const SDL_KeyboardEvent &event)
         break;
     case SDL_SCANCODE_F2:
         if (keymod == KMOD_NONE) {
-            choose_midi_output(true, last_midi_output_choice_);
+            // not available before the device list is known
+            if (midi_online_)
+                choose_midi_output(true, last_midi_output_choice_);
             return true;
         }
         break;
     case SDL_SCANCODE_F3:
         if (keymod == KMOD_NONE) {
-            choose_synth(true, last_synth_choice_);
+            // not available before the plugin list is known, and the device is up
+            if (synth_online_ && player_->is_audio_ready())
+                choose_synth(true, last_synth_choice_);
             return true;
         }
         break;
     case SDL_SCANCODE_F4:
         if (keymod == KMOD_NONE) {
-            open_fx_dialog();
+            // not available before the device is up
+            if (player_->is_audio_ready())
+                open_fx_dialog();
             return true;
         }
         break;
@@ -1318,7 +1404,11 @@ void Application::choose_midi_output(bool ask, gsl::cstring_span choice)
 {
     std::vector<Midi_Output> outputs;
     get_midi_outputs(outputs);
+    choose_midi_output(ask, choice, outputs);
+}
 
+void Application::choose_midi_output(bool ask, gsl::cstring_span choice, const std::vector<Midi_Output> &outputs)
+{
     std::vector<std::string> choices;
     choices.reserve(1 + outputs.size());
 
@@ -1630,19 +1720,7 @@ std::unique_ptr<CSimpleIniA> Application::initialize_config()
         ini_update = true;
     }
 
-    if (!ini->GetValue("", "synth-device")) {
-        const std::vector<Synth_Host::Plugin_Info> &plugins = Synth_Host::plugins();
-        const char *default_synth_name = nullptr;
-
-        for (size_t i = 0, n = plugins.size(); i < n && !default_synth_name; ++i) {
-            const Synth_Host::Plugin_Info &info = plugins[i];
-            if (info.id == default_synth_id)
-                default_synth_name = info.name.c_str();
-        }
-
-        ini->SetValue("", "synth-device", default_synth_name ? default_synth_name : "", "; Selected device for synthesis");
-        ini_update = true;
-    }
+    // the default synth-device is resolved after the plugin scan
 
     if (!ini->GetValue("", "synth-sample-rate")) {
         ini->SetDoubleValue("", "synth-sample-rate", 44100, "; Sample rate of synthesized audio stream (Hz) [22050:192000]");
@@ -1654,6 +1732,56 @@ std::unique_ptr<CSimpleIniA> Application::initialize_config()
         ini_update = true;
     }
 
+    if (!ini->GetValue("", "synth-render-ahead")) {
+        ini->SetDoubleValue("", "synth-render-ahead", 0, "; Duration of audio rendered in advance of the device, which adds to latency (ms) [0:500]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-cache-memory")) {
+        ini->SetDoubleValue("", "synth-cache-memory", 256, "; Memory budget for keeping recently used synthesizers ready, each estimated by the growth of the process at its creation (MiB) [0:65536]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-parallel-instances")) {
+        ini->SetLongValue("", "synth-parallel-instances", 1, "; Number of synthesizers which render the MIDI channels in parallel [1:16]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-parallel-partition")) {
+        ini->SetValue("", "synth-parallel-partition", "interleaved", "; Distribution of MIDI channels to parallel synthesizers (interleaved, contiguous, percussion)");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-native-rate")) {
+        ini->SetBoolValue("", "synth-native-rate", true, "; Render synthesizers at their native rate, and resample to the audio stream");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-plugin-threads")) {
+        ini->SetLongValue("", "synth-plugin-threads", -1, "; Number of threads which synthesizers share for their parallel work, -1 for automatic [-1:15]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-polyphony-governor")) {
+        ini->SetBoolValue("", "synth-polyphony-governor", true, "; Reduce the polyphony of synthesizers under a sustained processor overload");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-isolation")) {
+        ini->SetBoolValue("", "synth-isolation", false, "; Run synthesizers in child processes, which are restarted if they crash or hang");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "realtime-profile")) {
+        ini->SetBoolValue("", "realtime-profile", false, "; Run the audio and player threads with real-time scheduling, and lock memory");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "realtime-priority")) {
+        ini->SetLongValue("", "realtime-priority", 60, "; Priority of the real-time audio threads [1:99]");
+        ini_update = true;
+    }
+
     if (!ini->GetValue("", "theme")) {
         ini->SetValue("", "theme", "default", "; Theme of the graphical interface");
         ini_update = true;
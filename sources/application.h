@@ -21,6 +21,7 @@ class Player;
 struct Player_State;
 class Main_Layout;
 struct Midi_Output;
+class Task_Graph;
 
 class Application
 {
@@ -73,6 +74,10 @@ public:
 
 private:
     std::unique_ptr<CSimpleIniA> initialize_config();
+    void start_background_init();
+    void advance_background_init();
+    void resolve_default_synth();
+    void choose_midi_output(bool ask, gsl::cstring_span choice, const std::vector<Midi_Output> &outputs);
 
 private:
     void receive_state_in_other_thread(const Player_State &ps);
@@ -101,6 +106,14 @@ private:
     std::unique_ptr<Level_Meter> level_meter_[10];
     std::unique_ptr<Player> player_;
 
+    // initialization which completes after the window has appeared
+    std::unique_ptr<Task_Graph> startup_;
+    size_t startup_plugins_task_ = 0;
+    size_t startup_midi_task_ = 0;
+    std::unique_ptr<std::vector<Midi_Output>> startup_midi_outputs_;
+    bool synth_online_ = false;
+    bool midi_online_ = false;
+
     std::string last_midi_output_choice_;
     std::string last_synth_choice_;
     std::string last_theme_choice_;
@@ -117,7 +117,7 @@ float *analyzer_10band::compute(const float inputs[], size_t count)
     return outputs;
 }
 
-float *analyzer_10band::compute_stereo(const float inputs[], size_t count)
+float *analyzer_10band::compute_stereo(const float left[], const float right[], size_t count)
 {
     size_t index = 0;
     constexpr size_t bufsize = 512;
@@ -127,10 +127,8 @@ float *analyzer_10band::compute_stereo(const float inputs[], size_t count)
         cur = (cur < bufsize) ? cur : bufsize;
 
         float mixdown[bufsize];
-        for (size_t i = 0; i < cur; ++i) {
-            const float *frame = &inputs[2 * (index + i)];
-            mixdown[i] = float(M_SQRT1_2) * (frame[0] + frame[1]);
-        }
+        for (size_t i = 0; i < cur; ++i)
+            mixdown[i] = float(M_SQRT1_2) * (left[index + i] + right[index + i]);
 
         compute(mixdown, cur);
         index += cur;
@@ -14,7 +14,7 @@ public:
     void setup(float M, float ftop, float t60); // M=1, ftop=10e3, t60=100e-3
     void clear();
     float *compute(const float inputs[], size_t count);
-    float *compute_stereo(const float inputs[], size_t count);
+    float *compute_stereo(const float left[], const float right[], size_t count);
 
 private:
     enum { N = 10 };
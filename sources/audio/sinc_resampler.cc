@@ -0,0 +1,190 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sinc_resampler.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+static constexpr double kaiser_beta = 8.0;
+// passband, relative to the lowest of the Nyquist frequencies
+static constexpr double passband_ratio = 0.92;
+static constexpr size_t initial_history_capacity = 4096;
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (unsigned k = 1; k < 32; ++k) {
+        double f = x / (2 * k);
+        term *= f * f;
+        sum += term;
+    }
+    return sum;
+}
+
+Sinc_Resampler::Sinc_Resampler()
+{
+}
+
+Sinc_Resampler::~Sinc_Resampler()
+{
+}
+
+void Sinc_Resampler::init(double source_rate, double target_rate)
+{
+    step_ = (uint64_t)std::llround(source_rate / target_rate * 4294967296.0);
+
+    filter_storage_.reset(new float[(phases + 1) * taps + 4]);
+    filter_ = reinterpret_cast<float *>(
+        (reinterpret_cast<uintptr_t>(filter_storage_.get()) + 15) & ~(uintptr_t)15);
+
+    const double cutoff = passband_ratio * std::min(1.0, target_rate / source_rate);
+    const double radius = taps / 2;
+    const double i0_beta = bessel_i0(kaiser_beta);
+
+    for (unsigned p = 0; p <= phases; ++p) {
+        float *h = phase_filter(p);
+        double frac = (double)p / phases;
+        double sum = 0;
+        for (unsigned k = 0; k < taps; ++k) {
+            // distance from the output time to this source frame
+            double d = (double)k - (taps / 2 - 1) - frac;
+            double x = cutoff * d;
+            double sinc = (x == 0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double r = d / radius;
+            double window = (r * r < 1) ? bessel_i0(kaiser_beta * std::sqrt(1 - r * r)) / i0_beta : 0.0;
+            double value = cutoff * sinc * window;
+            h[k] = (float)value;
+            sum += value;
+        }
+        // unity gain at DC
+        for (unsigned k = 0; k < taps; ++k)
+            h[k] = (float)(h[k] / sum);
+    }
+
+    history_capacity_ = initial_history_capacity + taps;
+    for (unsigned c = 0; c < 2; ++c)
+        history_[c].reset(new float[history_capacity_]);
+
+    clear();
+}
+
+void Sinc_Resampler::clear()
+{
+    // the first output is centered on the first frame to be written
+    history_frames_ = taps / 2 - 1;
+    for (unsigned c = 0; c < 2; ++c)
+        std::fill(&history_[c][0], &history_[c][history_frames_], 0.0f);
+    position_ = 0;
+}
+
+size_t Sinc_Resampler::input_needed(size_t nframes) const
+{
+    if (nframes == 0)
+        return 0;
+
+    uint64_t last = position_ + (uint64_t)(nframes - 1) * step_;
+    size_t frames_needed = (size_t)(last >> 32) + taps;
+    return (frames_needed > history_frames_) ? (frames_needed - history_frames_) : 0;
+}
+
+void Sinc_Resampler::write(const float *input, size_t nframes)
+{
+    size_t frames = history_frames_;
+
+    if (frames + nframes > history_capacity_) {
+        size_t capacity = std::max(frames + nframes, 2 * history_capacity_);
+        for (unsigned c = 0; c < 2; ++c) {
+            float *history = new float[capacity];
+            std::copy(&history_[c][0], &history_[c][frames], history);
+            history_[c].reset(history);
+        }
+        history_capacity_ = capacity;
+    }
+
+    float *ch1 = &history_[0][frames];
+    float *ch2 = &history_[1][frames];
+    for (size_t i = 0; i < nframes; ++i) {
+        ch1[i] = input[2 * i];
+        ch2[i] = input[2 * i + 1];
+    }
+
+    history_frames_ = frames + nframes;
+}
+
+void Sinc_Resampler::read(float *output, size_t nframes)
+{
+    const float *ch1 = history_[0].get();
+    const float *ch2 = history_[1].get();
+    uint64_t position = position_;
+    const uint64_t step = step_;
+
+    for (size_t i = 0; i < nframes; ++i) {
+        size_t base = (size_t)(position >> 32);
+        uint32_t frac = (uint32_t)position;
+        // phases=256: high 8 bits select the phase, the rest interpolates
+        unsigned phase = frac >> 24;
+        float mu = (float)(frac & 0xffffff) * (1.0f / 16777216.0f);
+
+        const float *h0 = phase_filter(phase);
+        const float *h1 = phase_filter(phase + 1);
+        const float *x1 = &ch1[base];
+        const float *x2 = &ch2[base];
+
+#if defined(__SSE__)
+        __m128 a10 = _mm_setzero_ps(), a11 = _mm_setzero_ps();
+        __m128 a20 = _mm_setzero_ps(), a21 = _mm_setzero_ps();
+        for (unsigned k = 0; k < taps; k += 4) {
+            __m128 c0 = _mm_load_ps(&h0[k]);
+            __m128 c1 = _mm_load_ps(&h1[k]);
+            __m128 s1 = _mm_loadu_ps(&x1[k]);
+            __m128 s2 = _mm_loadu_ps(&x2[k]);
+            a10 = _mm_add_ps(a10, _mm_mul_ps(s1, c0));
+            a11 = _mm_add_ps(a11, _mm_mul_ps(s1, c1));
+            a20 = _mm_add_ps(a20, _mm_mul_ps(s2, c0));
+            a21 = _mm_add_ps(a21, _mm_mul_ps(s2, c1));
+        }
+        // interpolate the phases, then sum horizontally
+        __m128 vmu = _mm_set1_ps(mu);
+        __m128 r1 = _mm_add_ps(a10, _mm_mul_ps(vmu, _mm_sub_ps(a11, a10)));
+        __m128 r2 = _mm_add_ps(a20, _mm_mul_ps(vmu, _mm_sub_ps(a21, a20)));
+        __m128 lo = _mm_unpacklo_ps(r1, r2); // r1[0] r2[0] r1[1] r2[1]
+        __m128 hi = _mm_unpackhi_ps(r1, r2); // r1[2] r2[2] r1[3] r2[3]
+        __m128 sum = _mm_add_ps(lo, hi);
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        _mm_storel_pi(reinterpret_cast<__m64 *>(&output[2 * i]), sum);
+#else
+        float a10 = 0, a11 = 0, a20 = 0, a21 = 0;
+        for (unsigned k = 0; k < taps; ++k) {
+            a10 += x1[k] * h0[k];
+            a11 += x1[k] * h1[k];
+            a20 += x2[k] * h0[k];
+            a21 += x2[k] * h1[k];
+        }
+        output[2 * i] = a10 + mu * (a11 - a10);
+        output[2 * i + 1] = a20 + mu * (a21 - a20);
+#endif
+
+        position += step;
+    }
+
+    // drop the source frames which are no longer needed
+    size_t consumed = std::min((size_t)(position >> 32), history_frames_);
+    size_t remaining = history_frames_ - consumed;
+    for (unsigned c = 0; c < 2; ++c) {
+        float *history = history_[c].get();
+        std::memmove(history, &history[consumed], remaining * sizeof(float));
+    }
+    history_frames_ = remaining;
+    position_ = position - ((uint64_t)consumed << 32);
+}
+
+float *Sinc_Resampler::phase_filter(unsigned phase) const
+{
+    return &filter_[phase * taps];
+}
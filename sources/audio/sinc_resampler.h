@@ -0,0 +1,45 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Stereo windowed-sinc resampler, with a polyphase table which is
+// interpolated linearly between adjacent phases.
+class Sinc_Resampler {
+public:
+    Sinc_Resampler();
+    ~Sinc_Resampler();
+
+    void init(double source_rate, double target_rate);
+    void clear();
+
+    // number of source frames to write, before the given number can be read
+    size_t input_needed(size_t nframes) const;
+    // writes interleaved stereo source frames
+    void write(const float *input, size_t nframes);
+    // reads interleaved stereo target frames, if enough input is available
+    void read(float *output, size_t nframes);
+
+public:
+    enum { taps = 32, phases = 256 };
+
+private:
+    float *phase_filter(unsigned phase) const;
+
+private:
+    // (phases + 1) filters of taps coefficients, 16-byte aligned
+    std::unique_ptr<float[]> filter_storage_;
+    float *filter_ = nullptr;
+    // planar history of the source
+    std::unique_ptr<float[]> history_[2];
+    size_t history_capacity_ = 0;
+    size_t history_frames_ = 0;
+    // position of the next output in the history, in 32.32 fixed point
+    uint64_t position_ = 0;
+    uint64_t step_ = 0;
+};
@@ -5,13 +5,17 @@
 
 #include "application.h"
 #include "ui/paint.h"
+#include "synth/synth_remote.h"
 #include "utility/paths.h"
 #include "utility/module.h"
 #include "utility/charset.h"
+#include "utility/task_graph.h"
 #include "utility/logs.h"
 #include <gsl/gsl>
 #include <getopt.h>
 #include <memory>
+#include <cstring>
+#include <cstdlib>
 #if defined(__linux__)
 #include <jack/jack.h>
 #include <alsa/asoundlib.h>
@@ -33,6 +37,10 @@ int main(int argc, char *argv[])
 int real_main(int argc, char *argv[])
 #endif
 {
+    // Run as the child process of an isolated synth
+    if (argc == 3 && !strcmp(argv[1], Synth_Remote::child_argument))
+        return Synth_Remote::child_main(atoi(argv[2]));
+
     // Initialize command line
     for (int c; (c = getopt(argc, argv, "")) != -1;) {
         switch (c) {
@@ -72,11 +80,13 @@ int real_main(int argc, char *argv[])
     auto sdl_cleanup = gsl::finally([subsys] { SDL_QuitSubSystem(subsys); });
 
     // Initialize App and Window
+    std::unique_ptr<Phase_Timer> phase_timer(new Phase_Timer("application"));
     Application app;
     if (!initial_path.empty())
         app.set_current_path(initial_path);
 
     Log::i("Creating window");
+    phase_timer.reset(new Phase_Timer("window"));
     SDL_Window *win = app.init_window();
     if (!win) {
         Log::e("Error creating window");
@@ -85,6 +95,7 @@ int real_main(int argc, char *argv[])
     Log::s("New window: %p", win);
 
     Log::i("Creating renderer");
+    phase_timer.reset(new Phase_Timer("renderer"));
     SDL_Renderer *rr = app.init_renderer();
     if (!rr) {
         Log::e("Error creating window renderer");
@@ -92,10 +103,12 @@ int real_main(int argc, char *argv[])
     }
     Log::s("New renderer: %p", rr);
 
-    // Initial painting
+    // Initial painting, while audio and plugins are still initializing
+    phase_timer.reset(new Phase_Timer("first paint"));
     app.paint_cached_background(rr);
     app.paint(rr, Pt_Foreground);
     SDL_RenderPresent(rr);
+    phase_timer.reset();
 
     // Event handling
     app.exec();
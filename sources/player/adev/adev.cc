@@ -9,6 +9,7 @@
 #include "adev_jack.h"
 #include "adev_soundio.h"
 #include "adev_rtaudio.h"
+#include <algorithm>
 #include <memory>
 #include <cstring>
 
@@ -54,8 +55,38 @@ void Audio_Device::process_cycle(float *output, unsigned nframes)
 {
     std::unique_lock<std::mutex> lock(cbmutex_, std::try_to_lock);
 
-    if (lock.owns_lock() && cb_)
-        cb_(reinterpret_cast<float *>(output), nframes, cbdata_);
-    else
+    if (!lock.owns_lock() || !cb_) {
+        if (!lock.owns_lock())
+            silent_cycles_.fetch_add(1, std::memory_order_relaxed);
         std::memset(output, 0, 2 * nframes * sizeof(float));
+        return;
+    }
+
+    float *left = planar_buffer_;
+    float *right = planar_buffer_ + planar_frames_max;
+
+    while (nframes > 0) {
+        unsigned nframes_current = std::min<unsigned>(nframes, planar_frames_max);
+        cb_(left, right, nframes_current, cbdata_);
+        for (unsigned i = 0; i < nframes_current; ++i) {
+            output[2 * i] = left[i];
+            output[2 * i + 1] = right[i];
+        }
+        output += 2 * nframes_current;
+        nframes -= nframes_current;
+    }
+}
+
+void Audio_Device::process_cycle_planar(float *left, float *right, unsigned nframes)
+{
+    std::unique_lock<std::mutex> lock(cbmutex_, std::try_to_lock);
+
+    if (lock.owns_lock() && cb_)
+        cb_(left, right, nframes, cbdata_);
+    else {
+        if (!lock.owns_lock())
+            silent_cycles_.fetch_add(1, std::memory_order_relaxed);
+        std::memset(left, 0, nframes * sizeof(float));
+        std::memset(right, 0, nframes * sizeof(float));
+    }
 }
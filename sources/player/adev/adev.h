@@ -5,6 +5,7 @@
 
 #pragma once
 #include <mutex>
+#include <atomic>
 
 class Audio_Device {
 public:
@@ -13,7 +14,9 @@ public:
     static Audio_Device *create_best_for_system();
     virtual const char *audio_system_name() const noexcept = 0;
 
-    typedef void (audio_callback_t)(float *output, unsigned nframes, void *user_data);
+    // the channels are separate, the devices which want them interleaved
+    // have it done by the base
+    typedef void (audio_callback_t)(float *left, float *right, unsigned nframes, void *user_data);
 
     virtual bool init(double desired_sample_rate, double desired_latency) = 0;
     virtual void shutdown() = 0;
@@ -22,11 +25,24 @@ public:
     virtual double latency() const = 0;
     virtual double sample_rate() const = 0;
 
+    // number of times the audio system reported an interruption of the stream
+    unsigned long xrun_count() const noexcept { return xruns_.load(std::memory_order_relaxed); }
+    // number of cycles which output silence, because the callback was busy
+    unsigned long silent_cycle_count() const noexcept { return silent_cycles_.load(std::memory_order_relaxed); }
+
 protected:
     void process_cycle(float *output, unsigned nframes);
+    void process_cycle_planar(float *left, float *right, unsigned nframes);
+    void report_xrun() noexcept { xruns_.fetch_add(1, std::memory_order_relaxed); }
     std::mutex cbmutex_;
 
 private:
     audio_callback_t *cb_ = nullptr;
     void *cbdata_ = nullptr;
+    std::atomic<unsigned long> xruns_{0};
+    std::atomic<unsigned long> silent_cycles_{0};
+
+    // the channels of an interleaved cycle, before they are interleaved
+    enum { planar_frames_max = 256 };
+    float planar_buffer_[2 * planar_frames_max];
 };
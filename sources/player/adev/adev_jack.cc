@@ -33,12 +33,11 @@ bool Audio_Device_Jack::init(double desired_sample_rate, double desired_latency)
     }
 
     jack_set_process_callback(client.get(), &jack_audio_callback, this);
+    jack_set_xrun_callback(client.get(), &jack_xrun_callback, this);
 
     double audio_rate = jack_get_sample_rate(client.get());
     jack_nframes_t audio_buffer_size = jack_get_buffer_size(client.get());
 
-    buffer_.reset(new float[2 * audio_buffer_size]);
-
     client_ = std::move(client);
     audio_rate_ = audio_rate;
     audio_latency_ = audio_buffer_size / audio_rate;
@@ -83,16 +82,17 @@ int Audio_Device_Jack::jack_audio_callback(jack_nframes_t nframes, void *user_da
 {
     Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
 
-    float *buffer = self->buffer_.get();
-    self->process_cycle(buffer, nframes);
-
     float *out1 = reinterpret_cast<float *>(jack_port_get_buffer(self->ports_[0], nframes));
     float *out2 = reinterpret_cast<float *>(jack_port_get_buffer(self->ports_[1], nframes));
-    for (jack_nframes_t i = 0; i < nframes; ++i) {
-        out1[i] = buffer[2 * i];
-        out2[i] = buffer[2 * i + 1];
-    }
+    self->process_cycle_planar(out1, out2, nframes);
+
+    return 0;
+}
 
+int Audio_Device_Jack::jack_xrun_callback(void *user_data)
+{
+    Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
+    self->report_xrun();
     return 0;
 }
 
@@ -25,6 +25,7 @@ public:
 
 private:
     static int jack_audio_callback(jack_nframes_t nframes, void *user_data);
+    static int jack_xrun_callback(void *user_data);
     void connect_physical_ports();
 
     typedef std::array<std::list<std::string>, 2> Connections;
@@ -38,7 +39,6 @@ private:
 
 private:
     std::array<jack_port_t *, 2> ports_ {};
-    std::unique_ptr<float[]> buffer_;
     double audio_rate_ = 0.0;
     double audio_latency_ = 0.0;
     jack_client_u client_;
@@ -32,6 +32,7 @@ bool Audio_Device_Rt::init(double desired_sample_rate, double desired_latency)
 
     RtAudio::StreamOptions audio_opt;
     audio_opt.streamName = PROGRAM_DISPLAY_NAME;
+    audio_opt.flags = RTAUDIO_NONINTERLEAVED;
 
     double audio_rate = audio_devinfo.preferredSampleRate;
     unsigned audio_buffer_size = (unsigned)std::ceil(desired_latency * audio_rate);
@@ -72,10 +73,13 @@ double Audio_Device_Rt::sample_rate() const
     return audio_rate_;
 }
 
-int Audio_Device_Rt::rtaudio_callback(void *output_buffer, void *, unsigned nframes, double, RtAudioStreamStatus, void *user_data)
+int Audio_Device_Rt::rtaudio_callback(void *output_buffer, void *, unsigned nframes, double, RtAudioStreamStatus status, void *user_data)
 {
     Audio_Device_Rt *self = reinterpret_cast<Audio_Device_Rt *>(user_data);
-    self->process_cycle(reinterpret_cast<float *>(output_buffer), nframes);
+    if (status & RTAUDIO_OUTPUT_UNDERFLOW)
+        self->report_xrun();
+    float *output = reinterpret_cast<float *>(output_buffer);
+    self->process_cycle_planar(output, output + nframes, nframes);
     return 0;
 }
 #endif
@@ -73,6 +73,7 @@ bool Audio_Device_SDL::start()
     if (!handle_)
         return false;
 
+    last_cycle_ = 0;
     SDL_PauseAudioDevice(handle_.get(), 0);
 
     active_ = true;
@@ -93,6 +94,17 @@ void SDLCALL Audio_Device_SDL::sdl_audio_callback(void *userdata, Uint8 *stream,
 {
     Audio_Device_SDL *self = (Audio_Device_SDL *)userdata;
     int nframes = len / (2 * sizeof(float));
+
+    // SDL does not report interruptions, so detect the late callbacks
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 then = self->last_cycle_;
+    self->last_cycle_ = now;
+    if (then != 0) {
+        double interval = (double)(now - then) / (double)SDL_GetPerformanceFrequency();
+        if (interval > 2.0 * self->latency_)
+            self->report_xrun();
+    }
+
     self->process_cycle(reinterpret_cast<float *>(stream), nframes);
 }
 
@@ -50,4 +50,5 @@ private:
     bool active_ = false;
     double sample_rate_ {};
     double latency_ {};
+    Uint64 last_cycle_ {};
 };
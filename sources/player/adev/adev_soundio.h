@@ -25,6 +25,7 @@ public:
 
 private:
     static void write_callback(SoundIoOutStream *outstream, int frame_count_min, int frame_count_max);
+    static void underflow_callback(SoundIoOutStream *outstream);
     float *get_temp_buffer(unsigned nframes);
 
 private:
@@ -0,0 +1,101 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "dsp_load.h"
+#include <algorithm>
+
+void Dsp_Load_Meter::add_cycle(const double stage_time[Dsp_Stage_Count], double period)
+{
+    Accumulator &acc = local_;
+
+    ++acc.cycles;
+    for (unsigned s = 0; s < Dsp_Stage_Count; ++s) {
+        double load = stage_time[s] / period;
+        acc.sum[s] += load;
+        acc.worst[s] = std::max(acc.worst[s], load);
+        unsigned bin = (unsigned)std::min(100.0 * load, (double)(histogram_size - 1));
+        ++acc.histogram[s][bin];
+    }
+
+    std::unique_lock<std::mutex> lock(shared_mutex_, std::try_to_lock);
+    if (lock.owns_lock()) {
+        shared_.merge(acc);
+        acc.clear();
+    }
+}
+
+Dsp_Load_Stats Dsp_Load_Meter::get_stats() const
+{
+    Dsp_Load_Stats stats;
+
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    const Accumulator &acc = shared_;
+
+    unsigned long cycles = acc.cycles;
+    stats.cycles = cycles;
+    if (cycles == 0)
+        return stats;
+
+    for (unsigned s = 0; s < Dsp_Stage_Count; ++s) {
+        stats.mean[s] = (float)(acc.sum[s] / cycles);
+        stats.worst[s] = (float)acc.worst[s];
+
+        unsigned long count = 0;
+        unsigned long rank95 = (cycles * 95 + 99) / 100;
+        unsigned long rank99 = (cycles * 99 + 99) / 100;
+        bool have95 = false;
+        for (unsigned bin = 0; bin < histogram_size; ++bin) {
+            count += acc.histogram[s][bin];
+            float upper = 0.01f * (bin + 1);
+            if (!have95 && count >= rank95) {
+                stats.p95[s] = upper;
+                have95 = true;
+            }
+            if (count >= rank99) {
+                stats.p99[s] = upper;
+                break;
+            }
+        }
+        // the bins give an upper bound, never report above the maximum
+        stats.p95[s] = std::min(stats.p95[s], stats.worst[s]);
+        stats.p99[s] = std::min(stats.p99[s], stats.worst[s]);
+    }
+
+    return stats;
+}
+
+void Dsp_Load_Meter::reset()
+{
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_.clear();
+}
+
+const char *Dsp_Load_Meter::stage_name(unsigned stage)
+{
+    switch (stage) {
+    case Dsp_Stage_Synth: return "synth";
+    case Dsp_Stage_Fx: return "fx";
+    case Dsp_Stage_Analyzer: return "analyzer";
+    case Dsp_Stage_Total: return "total";
+    default: return "";
+    }
+}
+
+///
+void Dsp_Load_Meter::Accumulator::merge(const Accumulator &other)
+{
+    cycles += other.cycles;
+    for (unsigned s = 0; s < Dsp_Stage_Count; ++s) {
+        sum[s] += other.sum[s];
+        worst[s] = std::max(worst[s], other.worst[s]);
+        for (unsigned bin = 0; bin < histogram_size; ++bin)
+            histogram[s][bin] += other.histogram[s][bin];
+    }
+}
+
+void Dsp_Load_Meter::Accumulator::clear()
+{
+    *this = Accumulator();
+}
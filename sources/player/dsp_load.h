@@ -0,0 +1,59 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <mutex>
+#include <cstdint>
+
+enum Dsp_Stage {
+    Dsp_Stage_Synth,
+    Dsp_Stage_Fx,
+    Dsp_Stage_Analyzer,
+    Dsp_Stage_Total,
+    Dsp_Stage_Count,
+};
+
+// loads are expressed as a ratio of the processing time to the buffer period
+struct Dsp_Load_Stats {
+    unsigned long cycles = 0;
+    float mean[Dsp_Stage_Count] {};
+    float p95[Dsp_Stage_Count] {};
+    float p99[Dsp_Stage_Count] {};
+    float worst[Dsp_Stage_Count] {};
+    unsigned long xruns = 0;
+    unsigned long silent_cycles = 0;
+    unsigned long underruns = 0;
+};
+
+class Dsp_Load_Meter {
+public:
+    // audio thread
+    void add_cycle(const double stage_time[Dsp_Stage_Count], double period);
+
+    // other threads
+    Dsp_Load_Stats get_stats() const;
+    void reset();
+
+    static const char *stage_name(unsigned stage);
+
+public:
+    // load histogram in steps of 1%, the last bin collects the overloads
+    static constexpr unsigned histogram_size = 201;
+
+    struct Accumulator {
+        unsigned long cycles = 0;
+        double sum[Dsp_Stage_Count] {};
+        double worst[Dsp_Stage_Count] {};
+        uint32_t histogram[Dsp_Stage_Count][histogram_size] {};
+        void merge(const Accumulator &other);
+        void clear();
+    };
+
+private:
+    // owned by the audio thread, merged into shared when the lock is free
+    Accumulator local_;
+    Accumulator shared_;
+    mutable std::mutex shared_mutex_;
+};
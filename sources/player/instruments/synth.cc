@@ -39,6 +39,9 @@ struct Midi_Synth_Instrument::Impl {
 
     std::mutex host_mutex_;
 
+    // idle and silent, not rendered until the next message
+    bool host_paused_ = false;
+
     volatile unsigned cycle_counter_ = 0;
 
     struct AudioConfig {
@@ -47,7 +50,7 @@ struct Midi_Synth_Instrument::Impl {
     };
     AudioConfig config;
 
-    void process_midi(double time_incr);
+    bool process_midi(double time_incr);
 
     bool extract_next_message();
 
@@ -105,6 +108,7 @@ void Midi_Synth_Instrument::open_midi_output(gsl::cstring_span id)
     impl.messages_initialized_.store(false);
     flush_events();
 
+    impl.host_paused_ = false;
     impl.eff_audio_rate_ = impl.config.rate;
     impl.eff_audio_latency_ = impl.config.latency;
 }
@@ -147,7 +151,7 @@ void Midi_Synth_Instrument::configure_audio(double audio_rate, double audio_late
     impl.config.latency = audio_latency;
 }
 
-void Midi_Synth_Instrument::generate_audio(float *output, unsigned nframes)
+bool Midi_Synth_Instrument::generate_audio(float *left, float *right, unsigned nframes, bool quiet)
 {
     Impl &impl = *impl_;
     Synth_Host &host = *impl.host_;
@@ -162,21 +166,36 @@ void Midi_Synth_Instrument::generate_audio(float *output, unsigned nframes)
         impl.have_next_message_ = false;
     }
 
+    // a cycle which misses the lock of the host outputs zero as well, but it
+    // is not a pause, which would restart the processing which follows
+    bool active = false;
     unsigned frame_index = 0;
     while (frame_index < nframes) {
         unsigned nframes_current = std::min(nframes - frame_index, midi_interval_max);
-        impl.process_midi(nframes_current * (1.0 / srate));
+        if (impl.process_midi(nframes_current * (1.0 / srate)))
+            impl.host_paused_ = false;
+        active = active || !impl.host_paused_;
         {
             std::unique_lock<std::mutex> lock(impl.host_mutex_, std::try_to_lock);
-            if (lock.owns_lock())
-                host.generate(&output[2 * frame_index], nframes_current);
-            else
-                std::memset(&output[2 * frame_index], 0, 2 * nframes_current * sizeof(float));
+            if (lock.owns_lock() && !impl.host_paused_) {
+                host.generate_planar(&left[frame_index], &right[frame_index], nframes_current);
+            }
+            else {
+                std::memset(&left[frame_index], 0, nframes_current * sizeof(float));
+                std::memset(&right[frame_index], 0, nframes_current * sizeof(float));
+            }
         }
         frame_index += nframes_current;
     }
 
+    if (quiet && !impl.host_paused_) {
+        std::unique_lock<std::mutex> lock(impl.host_mutex_, std::try_to_lock);
+        if (lock.owns_lock() && host.is_idle())
+            impl.host_paused_ = true;
+    }
+
     impl.cycle_counter_ += 1;
+    return active;
 }
 
 void Midi_Synth_Instrument::preload(const fmidi_smf_t &smf)
@@ -188,9 +207,10 @@ void Midi_Synth_Instrument::preload(const fmidi_smf_t &smf)
         host.preload(collect_file_instruments(smf));
 }
 
-void Midi_Synth_Instrument::Impl::process_midi(double time_incr)
+bool Midi_Synth_Instrument::Impl::process_midi(double time_incr)
 {
     Synth_Host &host = *host_;
+    bool received = false;
 
     time_delta_ += time_incr;
 
@@ -210,10 +230,13 @@ void Midi_Synth_Instrument::Impl::process_midi(double time_incr)
             std::unique_lock<std::mutex> lock(host_mutex_, std::try_to_lock);
             if (lock.owns_lock())
                 host.send_midi(next_message_, hdr.len);
+            received = true;
         }
 
         have_next_message_ = false;
     }
+
+    return received;
 }
 
 bool Midi_Synth_Instrument::Impl::extract_next_message()
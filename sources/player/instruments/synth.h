@@ -23,7 +23,10 @@ public:
     bool is_synth() const override { return true; }
 
     void configure_audio(double audio_rate, double audio_latency);
-    void generate_audio(float *output, unsigned nframes);
+    // when quiet, the synth may pause once idle, until the next message
+    // returns false if the synth is paused, and the output is zero; if the
+    // synth is busy elsewhere, the output is zero but it returns true
+    bool generate_audio(float *left, float *right, unsigned nframes, bool quiet);
 
     void preload(const fmidi_smf_t &smf);
 
@@ -52,45 +52,20 @@ void Synth_Fx::clear()
     rev_->clear();
 }
 
-void Synth_Fx::compute(float data[], unsigned nframes)
+void Synth_Fx::compute(float *left, float *right, unsigned nframes)
 {
     BassEnhance &be = *be_;
     Eq_5band &eq = *eq_;
     Reverb &rev = *rev_;
-    unsigned index = 0;
 
-    while (index < nframes) {
-        constexpr unsigned maxframes = 512;
+    if (be_enable_)
+        be.compute(left, right, nframes);
 
-        unsigned cur = nframes - index;
-        cur = (cur < maxframes) ? cur : maxframes;
+    if (eq_enable_)
+        eq.compute(left, right, nframes);
 
-        float ch1[maxframes];
-        float ch2[maxframes];
-
-        for (unsigned i = 0; i < cur; ++i) {
-            const float *frame = data + 2 * (index + i);
-            ch1[i] = frame[0];
-            ch2[i] = frame[1];
-        }
-
-        if (be_enable_)
-            be.compute(ch1, ch2, cur);
-
-        if (eq_enable_)
-            eq.compute(ch1, ch2, cur);
-
-        if (rev_enable_)
-            rev.compute(ch1, ch2, cur);
-
-        for (unsigned i = 0; i < cur; ++i) {
-            float *frame = data + 2 * (index + i);
-            frame[0] = ch1[i];
-            frame[1] = ch2[i];
-        }
-
-        index += cur;
-    }
+    if (rev_enable_)
+        rev.compute(left, right, nframes);
 }
 
 int Synth_Fx::get_parameter(size_t index) const
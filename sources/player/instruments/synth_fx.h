@@ -21,7 +21,7 @@ public:
 
     void init(float sample_rate);
     void clear();
-    void compute(float data[], unsigned nframes);
+    void compute(float *left, float *right, unsigned nframes);
 
     int get_parameter(size_t index) const;
     void set_parameter(size_t index, int value);
@@ -10,6 +10,7 @@
 #include "command.h"
 #include "clock.h"
 #include "smftext.h"
+#include "smfutil.h"
 #include "configuration.h"
 #include "adev/adev.h"
 #include "instruments/port.h"
@@ -18,35 +19,47 @@
 #include "synth/synth_host.h"
 #include "utility/charset.h"
 #include "utility/uv++.h"
+#include "utility/realtime.h"
+#include "utility/task_graph.h"
 #include "utility/logs.h"
+#include <ring_buffer.h>
 #include <gsl/gsl>
 #include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <cassert>
 
+// frames rendered at once by the render-ahead thread
+static constexpr unsigned render_ahead_block = 256;
+
+// interval of the DSP load report (ms)
+static constexpr unsigned dsp_load_log_interval = 10000;
+
+// peak under which the output is considered silent (about -100 dBFS)
+static constexpr float silence_threshold = 1e-5f;
+// duration of silence before an idle synth is paused, with the effects (s)
+static constexpr double silence_hold_time = 0.5;
+
+static bool is_silent(const float *left, const float *right, size_t count)
+{
+    float peak = 0;
+    for (size_t i = 0; i < count; ++i)
+        peak = std::max(peak, std::max(std::fabs(left[i]), std::fabs(right[i])));
+    return peak < silence_threshold;
+}
+
 Player::Player()
     : quit_(false),
       play_list_(new Linear_Play_List),
       seek_state_(new Seek_State),
       midiport_ins_(new Midi_Port_Instrument)
 {
-    // scan and initialize plugins
-    Synth_Host::plugins();
+    realtime_initialize();
 
-    // create audio device
-    Synth_Fx *fx = new Synth_Fx;
-    fx_.reset(fx);
-    if (Audio_Device *adev = init_audio_device()) {
-        float sample_rate = adev->sample_rate();
-        synth_ins_.reset(new Midi_Synth_Instrument);
-        adev->set_callback(&audio_callback, this);
-        analyzer_10band &an = level_analyzer_;
-        an.init(sample_rate);
-        an.setup(1.0, 16e3, 100e-3);
-        fx->init(sample_rate);
-        adev->start();
-    }
+    fx_.reset(new Synth_Fx);
 
     // initialize seeker
     seek_state_->set_message_callback(+[](const uint8_t *msg, uint32_t len, void *ptr) {
@@ -65,6 +78,8 @@ Player::~Player()
     uv_async_send(async_);
     ready_cv_.wait(lock);
     thread_.join();
+
+    stop_render_ahead();
 }
 
 void Player::push_command(std::unique_ptr<Player_Command> cmd)
@@ -77,6 +92,8 @@ void Player::push_command(std::unique_ptr<Player_Command> cmd)
 
 void Player::thread_exec()
 {
+    realtime_setup_thread(Realtime_Thread_Player);
+
 #if UV_VERSION_MAJOR >= 1
     uv_loop_t loop_buf;
     uv_loop_t *loop = &loop_buf;
@@ -102,11 +119,19 @@ void Player::thread_exec()
     clock.TimerCallback = [this](uint64_t elapsed) { tick(elapsed); };
     clock_ = &clock;
 
+    Player_Clock load_clock(loop);
+    load_clock.TimerCallback = [this](uint64_t elapsed) { if (elapsed > 0) log_dsp_load(); };
+    load_clock.start(dsp_load_log_interval);
+
     {
         std::lock_guard<std::mutex> lock(ready_mutex_);
         ready_cv_.notify_one();
     }
 
+    // the commands received until then wait in queue
+    initialize_audio();
+    audio_ready_.store(true);
+
     while (!quit_.load()) {
         process_command_queue();
         uv_run(loop, UV_RUN_ONCE);
@@ -118,6 +143,30 @@ void Player::thread_exec()
     ready_cv_.notify_one();
 }
 
+void Player::initialize_audio()
+{
+    // scan and initialize plugins
+    {
+        Phase_Timer timer("plugin scan");
+        Synth_Host::plugins();
+    }
+
+    // create audio device
+    Phase_Timer timer("audio device");
+    Synth_Fx &fx = *fx_;
+    if (Audio_Device *adev = init_audio_device()) {
+        float sample_rate = adev->sample_rate();
+        synth_ins_.reset(new Midi_Synth_Instrument);
+        adev->set_callback(&audio_callback, this);
+        analyzer_10band &an = level_analyzer_;
+        an.init(sample_rate);
+        an.setup(1.0, 16e3, 100e-3);
+        fx.init(sample_rate);
+        start_render_ahead(sample_rate);
+        adev->start();
+    }
+}
+
 void Player::process_command_queue()
 {
     std::unique_lock<std::mutex> lock(cmd_mutex_, std::defer_lock);
@@ -242,7 +291,8 @@ void Player::process_command_queue()
             Audio_Device *adev = adev_.get();
 
             const double audio_rate = adev->sample_rate();
-            const double audio_latency = adev->latency();
+            // events are delayed further by the time rendered in advance
+            const double audio_latency = adev->latency() + render_ahead_;
             ins->configure_audio(audio_rate, audio_latency);
             Log::i("Audio rate: %f Hz", audio_rate);
             Log::i("Audio latency: %f ms", 1e3 * audio_latency);
@@ -483,48 +533,6 @@ void Player::play_meta(uint8_t type, const uint8_t *msg, uint32_t len)
     }
 }
 
-///
-static bool is_midi_reset_message(const uint8_t *msg, uint32_t len)
-{
-    if (len >= 1 && msg[0] == 0xff) // GM system reset
-        return true;
-
-    if (len >= 4 && msg[0] == 0xf0 && msg[len - 1] == 0xf7) { // sysex resets
-        uint8_t manufacturer = msg[1];
-        uint8_t device_id = msg[2];
-        const uint8_t *payload = msg + 3;
-        uint8_t paysize = len - 4;
-
-        switch (manufacturer) {
-        case 0x7e: { // GM system messages
-            const uint8_t gm_on[] = {0x09, 0x01};
-            if (paysize >= 2 && !memcmp(gm_on, payload, 2))
-                return true;
-            break;
-        }
-        case 0x43: { // Yamaha XG
-            const uint8_t xg_on[] = {0x4c, 0x00, 0x00, 0x7e};
-            const uint8_t all_reset[] = {0x4c, 0x00, 0x00, 0x7f};
-            if ((device_id & 0xf0) == 0x10 && paysize >= 4 &&
-                (!memcmp(xg_on, payload, 4) || !memcmp(all_reset, payload, 4)))
-                return true;
-            break;
-        }
-        case 0x41: { // Roland GS / Roland MT-32
-            const uint8_t gs_on[] = {0x42, 0x12, 0x40, 0x00, 0x7f};
-            const uint8_t mt32_reset[] = {0x16, 0x12, 0x7f};
-            if ((device_id & 0xf0) == 0x10 &&
-                ((paysize >= 5 && !memcmp(gs_on, payload, 5)) ||
-                 (paysize >= 3 && !memcmp(mt32_reset, payload, 3))))
-                return true;
-            break;
-        }
-        }
-    }
-
-    return false;
-}
-
 ///
 void Player::seeker_play_message(const uint8_t *msg, uint32_t len)
 {
@@ -640,9 +648,52 @@ Player_State Player::make_state() const
     for (size_t p = 0; p < Synth_Fx::Parameter_Count; ++p)
         ps.fx_parameters[p] = fx.get_parameter(p);
 
+    ps.dsp_load = make_dsp_load_stats();
+
     return ps;
 }
 
+Dsp_Load_Stats Player::make_dsp_load_stats() const
+{
+    Dsp_Load_Stats stats = dsp_load_.get_stats();
+
+    if (Audio_Device *adev = adev_.get()) {
+        stats.xruns = adev->xrun_count();
+        stats.silent_cycles = adev->silent_cycle_count();
+    }
+    stats.underruns = render_underruns_.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void Player::log_dsp_load()
+{
+    Dsp_Load_Stats stats = make_dsp_load_stats();
+    unsigned long incidents = stats.xruns + stats.silent_cycles + stats.underruns;
+
+    // report while playing, or whenever there is a new incident
+    bool playing = clock_->active();
+    if (!playing && incidents == dsp_load_last_incidents_) {
+        dsp_load_.reset();
+        return;
+    }
+    dsp_load_last_incidents_ = incidents;
+
+    if (stats.cycles > 0) {
+        for (unsigned s = 0; s < Dsp_Stage_Count; ++s) {
+            Log::i("DSP load %s: mean %.1f%%, p95 %.1f%%, p99 %.1f%%, max %.1f%%",
+                   Dsp_Load_Meter::stage_name(s),
+                   100.0 * stats.mean[s], 100.0 * stats.p95[s],
+                   100.0 * stats.p99[s], 100.0 * stats.worst[s]);
+        }
+    }
+
+    Log::i("Audio incidents: %lu xruns, %lu silent cycles, %lu render underruns",
+           stats.xruns, stats.silent_cycles, stats.underruns);
+
+    dsp_load_.reset();
+}
+
 std::vector<Midi_Instrument *> Player::instruments() const
 {
     std::vector<Midi_Instrument *> ins;
@@ -699,6 +750,9 @@ Audio_Device *Player::init_audio_device()
     double desired_latency = ini->GetDoubleValue("", "synth-audio-latency", 50);
     desired_latency = 1e-3 * std::max(1.0, std::min(500.0, desired_latency));
 
+    double render_ahead = ini->GetDoubleValue("", "synth-render-ahead", 0);
+    render_ahead_ = 1e-3 * std::max(0.0, std::min(500.0, render_ahead));
+
     if (!adev->init(desired_sample_rate, desired_latency)) {
         Log::e("Cannot initialize the audio device");
         adev_.reset();
@@ -710,30 +764,166 @@ Audio_Device *Player::init_audio_device()
     return adev;
 }
 
-void Player::audio_callback(float *output, unsigned nframes, void *user_data)
+void Player::audio_callback(float *left, float *right, unsigned nframes, void *user_data)
 {
     Player *self = reinterpret_cast<Player *>(user_data);
-    self->synth_ins_->generate_audio(output, nframes);
+
+    if (!self->render_fifo_) {
+        self->render_audio(left, right, nframes);
+        return;
+    }
+
+    // only copy what the render thread has prepared in advance, a block at
+    // a time, so the channels always stay in step
+    Ring_Buffer &fifo = *self->render_fifo_;
+    float *block = self->render_block_.get();
+    unsigned pos = self->render_block_pos_;
+    unsigned ncopy = 0;
+    while (ncopy < nframes) {
+        if (pos == render_ahead_block) {
+            if (!fifo.get(block, 2 * render_ahead_block))
+                break;
+            pos = 0;
+        }
+        unsigned n = std::min(nframes - ncopy, render_ahead_block - pos);
+        std::memcpy(&left[ncopy], &block[pos], n * sizeof(float));
+        std::memcpy(&right[ncopy], &block[render_ahead_block + pos], n * sizeof(float));
+        ncopy += n;
+        pos += n;
+    }
+    self->render_block_pos_ = pos;
+    if (ncopy < nframes) {
+        std::memset(&left[ncopy], 0, (nframes - ncopy) * sizeof(float));
+        std::memset(&right[ncopy], 0, (nframes - ncopy) * sizeof(float));
+        self->render_underruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // only if the render thread waits for room, and once per wait
+    if (ncopy > 0 && self->render_waiting_.exchange(false))
+        self->render_cv_.notify_one();
+}
+
+void Player::render_audio(float *left, float *right, unsigned nframes)
+{
+    // the device thread is not ours, protect the processing of this cycle
+    Denormal_Guard denormal_guard;
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point t_start = clock::now();
+
+    double sample_rate = adev_->sample_rate();
+    bool quiet = silent_time_ >= silence_hold_time;
+    bool paused = !synth_ins_->generate_audio(left, right, nframes, quiet);
+    clock::time_point t_synth = clock::now();
 
     ///
-    Synth_Fx &fx = *self->fx_;
+    Synth_Fx &fx = *fx_;
     bool fx_enabled;
-    switch (self->fx_enable_request_.exchange(-1)) {
+    switch (fx_enable_request_.exchange(-1)) {
     case 0: fx_enabled = false; break;
     case 1: fx_enabled = true; break;
-    default: fx_enabled = self->fx_enabled_; break;
+    default: fx_enabled = fx_enabled_; break;
     }
-    if (self->fx_enabled_ != fx_enabled) {
+    if (fx_enabled_ != fx_enabled) {
         if (fx_enabled)
             fx.clear();
-        self->fx_enabled_ = fx_enabled;
+        fx_enabled_ = fx_enabled;
     }
-    if (fx_enabled)
-        fx.compute(output, nframes);
+    if (fx_enabled && !paused)
+        fx.compute(left, right, nframes);
+    clock::time_point t_fx = clock::now();
 
     ///
-    const float *levels = self->level_analyzer_.compute_stereo(output, nframes);
-    std::unique_lock<std::mutex> levels_lock(self->current_levels_mutex_, std::try_to_lock);
-    if (levels_lock.owns_lock())
-        std::memcpy(self->current_levels_, levels, 10 * sizeof(float));
+    if (!paused) {
+        const float *levels = level_analyzer_.compute_stereo(left, right, nframes);
+        std::unique_lock<std::mutex> levels_lock(current_levels_mutex_, std::try_to_lock);
+        if (levels_lock.owns_lock())
+            std::memcpy(current_levels_, levels, 10 * sizeof(float));
+        audio_paused_ = false;
+        // the synth may pause, once the tails of the effects have decayed
+        silent_time_ = is_silent(left, right, nframes) ? (silent_time_ + nframes / sample_rate) : 0;
+    }
+    else if (!audio_paused_) {
+        // the output is zero, start from a clean state when it resumes
+        std::unique_lock<std::mutex> levels_lock(current_levels_mutex_, std::try_to_lock);
+        if (levels_lock.owns_lock()) {
+            std::memset(current_levels_, 0, 10 * sizeof(float));
+            fx.clear();
+            level_analyzer_.clear();
+            audio_paused_ = true;
+        }
+    }
+    clock::time_point t_analyzer = clock::now();
+
+    ///
+    typedef std::chrono::duration<double> seconds;
+    double stage_time[Dsp_Stage_Count];
+    stage_time[Dsp_Stage_Synth] = seconds(t_synth - t_start).count();
+    stage_time[Dsp_Stage_Fx] = seconds(t_fx - t_synth).count();
+    stage_time[Dsp_Stage_Analyzer] = seconds(t_analyzer - t_fx).count();
+    stage_time[Dsp_Stage_Total] = seconds(t_analyzer - t_start).count();
+    dsp_load_.add_cycle(stage_time, nframes / sample_rate);
+}
+
+void Player::start_render_ahead(double sample_rate)
+{
+    if (render_ahead_ <= 0)
+        return;
+
+    size_t frames = (size_t)std::ceil(render_ahead_ * sample_rate);
+    size_t blocks = (frames + render_ahead_block - 1) / render_ahead_block;
+    blocks = std::max<size_t>(blocks, 1);
+    render_fifo_.reset(new Ring_Buffer((blocks + 1) * 2 * render_ahead_block * sizeof(float)));
+    render_block_.reset(new float[2 * render_ahead_block]());
+    render_block_pos_ = render_ahead_block;
+
+    Log::i("Audio render-ahead: %f ms", 1e3 * render_ahead_);
+
+    render_quit_.store(false);
+    render_thread_ = std::thread([this] { render_thread_exec(); });
+}
+
+void Player::stop_render_ahead()
+{
+    if (!render_thread_.joinable())
+        return;
+
+    render_quit_.store(true);
+    render_cv_.notify_one();
+    render_thread_.join();
+
+    unsigned long underruns = render_underruns_.load();
+    if (underruns > 0)
+        Log::w("Audio render-ahead underruns: %lu", underruns);
+}
+
+void Player::render_thread_exec()
+{
+    realtime_setup_thread(Realtime_Thread_Render);
+
+    Ring_Buffer &fifo = *render_fifo_;
+    const size_t block_size = 2 * render_ahead_block * sizeof(float);
+    std::unique_ptr<float[]> block(new float[2 * render_ahead_block]);
+    float *left = block.get();
+    float *right = block.get() + render_ahead_block;
+    bool rendered = false;
+
+    std::unique_lock<std::mutex> lock(render_mutex_);
+
+    while (!render_quit_.load()) {
+        if (!rendered && fifo.size_free() >= block_size) {
+            render_audio(left, right, render_ahead_block);
+            rendered = true;
+        }
+        if (rendered && fifo.put(block.get(), 2 * render_ahead_block)) {
+            rendered = false;
+            continue;
+        }
+        // woken by the audio callback, after it has consumed some audio;
+        // the timeout covers a wake-up which comes just before the wait
+        render_waiting_.store(true);
+        if (fifo.size_free() < block_size)
+            render_cv_.wait_for(lock, std::chrono::milliseconds(10));
+        render_waiting_.store(false);
+    }
 }
@@ -5,6 +5,7 @@
 
 #pragma once
 #include "state.h"
+#include "dsp_load.h"
 #include "audio/analyzer_10band.h"
 #include "synth/synth.h"
 #include <fmidi/fmidi.h>
@@ -26,6 +27,8 @@ enum Repeat_Mode : unsigned;
 class Synth_Host;
 class Synth_Fx;
 class Audio_Device;
+template <bool> class Ring_Buffer_Ex;
+typedef Ring_Buffer_Ex<true> Ring_Buffer;
 typedef struct uv_async_s uv_async_t;
 
 class Player {
@@ -34,11 +37,13 @@ public:
     ~Player();
 
     void push_command(std::unique_ptr<Player_Command> cmd);
+    bool is_audio_ready() const noexcept { return audio_ready_.load(); }
 
     std::function<void (const Player_State &)> StateCallback;
 
 private:
     void thread_exec();
+    void initialize_audio();
     void process_command_queue();
 
     void rewind();
@@ -63,6 +68,8 @@ private:
     void extract_smf_metadata();
 
     Player_State make_state() const;
+    Dsp_Load_Stats make_dsp_load_stats() const;
+    void log_dsp_load();
 
     std::vector<Midi_Instrument *> instruments() const;
 
@@ -70,7 +77,12 @@ private:
     bool stop_ticking();
 
     Audio_Device *init_audio_device();
-    static void audio_callback(float *output, unsigned nframes, void *user_data);
+    static void audio_callback(float *left, float *right, unsigned nframes, void *user_data);
+    void render_audio(float *left, float *right, unsigned nframes);
+
+    void start_render_ahead(double sample_rate);
+    void stop_render_ahead();
+    void render_thread_exec();
 
 private:
     std::thread thread_;
@@ -112,9 +124,32 @@ private:
     bool fx_enabled_ = false;
     std::atomic<int> fx_enable_request_ {};
     std::unique_ptr<Synth_Fx> fx_;
+    // duration of silence at the output, and whether the processing is paused
+    double silent_time_ = 0;
+    bool audio_paused_ = false;
+
+    // render-ahead
+    double render_ahead_ = 0;
+    // whole blocks of the left channel followed by the right
+    std::unique_ptr<Ring_Buffer> render_fifo_;
+    // the block which the audio callback reads, and its position in frames
+    std::unique_ptr<float[]> render_block_;
+    unsigned render_block_pos_ = 0;
+    std::thread render_thread_;
+    std::atomic_bool render_quit_{false};
+    std::mutex render_mutex_;
+    std::condition_variable render_cv_;
+    std::atomic_bool render_waiting_{false};
+    std::atomic<unsigned long> render_underruns_{0};
+
+    // load measurement
+    Dsp_Load_Meter dsp_load_;
+    unsigned long dsp_load_last_incidents_ = 0;
+
     std::unique_ptr<Audio_Device> adev_;
 
     // startup and shutdown synchronization
     std::condition_variable ready_cv_;
     std::mutex ready_mutex_;
+    std::atomic_bool audio_ready_{false};
 };
@@ -12,3 +12,6 @@
 // It computes a conservative estimate without trying to hard, that should
 // match most synthesizers regardless of MIDI support.
 std::vector<synth_midi_ins> collect_file_instruments(const fmidi_smf_t &smf);
+
+// Whether the message resets the device, the GM reset or a sysex of GM, GS, XG or MT-32.
+bool is_midi_reset_message(const uint8_t *msg, uint32_t len);
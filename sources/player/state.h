@@ -5,6 +5,7 @@
 
 #pragma once
 #include "keystate.h"
+#include "dsp_load.h"
 #include "instruments/synth_fx.h"
 #include <gsl/gsl>
 #include <string>
@@ -31,4 +32,5 @@ struct Player_State {
     std::bitset<16> channel_enabled;
     float audio_levels[10] {};
     int fx_parameters[Synth_Fx::Parameter_Count] {};
+    Dsp_Load_Stats dsp_load;
 };
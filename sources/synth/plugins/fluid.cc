@@ -5,11 +5,24 @@
 
 #include "../synth.h"
 #include "../synth_utility.h"
+#include "../sf2_subset.h"
 #include "utility/charset.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <fluidlite.h>
+#include <ring_buffer.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
@@ -21,10 +34,49 @@ typedef std::unique_ptr<fluid_synth_t, fluid_synth_delete> fluid_synth_u;
 typedef std::unique_ptr<fluid_settings_t, fluid_settings_delete> fluid_settings_u;
 ///
 
+// capacity of the messages deferred while the loader holds the synth
+static constexpr size_t fluid_pending_capacity = 16384;
+
+// a soundfont of which only the presets in use are loaded
+struct fluid_selective_sfont {
+    const uint8_t *image = nullptr;
+    bool mapped = false;
+    SF2_Subset index;
+};
+
 struct fluid_synth_object {
     string_list_ptr soundfonts;
     fluid_settings_u settings;
     fluid_synth_u synth;
+    std::vector<fluid_sfont_t *> sfonts;
+    // as configured, before the host reduces it under load
+    int polyphony = 0;
+
+    bool selective_loading = true;
+    bool map_samples = true;
+    std::vector<std::unique_ptr<fluid_selective_sfont>> selective;
+    std::vector<fluid_sfont_t *> subsets;
+
+    // the presets which miss at the time they are selected, loaded in the background;
+    // the audio thread marks them in the bitmap and queues them, without allocation,
+    // and the loader polls the queue
+    std::thread loader_thread;
+    std::mutex loader_mutex;
+    std::condition_variable loader_cond;
+    bool loader_quit = false;
+    unsigned loader_generation = 0;
+    std::unique_ptr<Ring_Buffer> loader_requests;
+    // a bit by preset key, under the synth lock
+    std::vector<uint32_t> presets_known;
+
+    // held by the loader while it adds its presets to the synth, which
+    // allocates; the audio thread does not wait, it defers its messages
+    // and renders silence until the synth is free again
+    std::mutex synth_mutex;
+    std::vector<uint8_t> pending_messages;
+    unsigned long dropped_messages = 0;
+    // the polyphony which the host requests, applied at the next block
+    std::atomic<int> polyphony_request{0};
 
     bool chorus_enable = false;
     int chorus_voices = 0;
@@ -41,6 +93,7 @@ struct fluid_synth_object {
 };
 
 static std::string fluid_synth_base_dir;
+static const synth_host_interface *fluid_host;
 
 ///
 
@@ -61,8 +114,430 @@ static void fluid_log_info(int, const char *message, void *)
 
 ///
 
+// a file which is read from the sample cache of the host
+// or from memory, if named by a fluid_memory_image
+struct fluid_memory_file {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    bool shared = false;
+};
+
+static const char fluid_memory_prefix[] = "memory:";
+
+// the images which can be opened, by an id which is never an address,
+// so a path which has the prefix cannot make the reader go astray
+struct fluid_memory_entry {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+};
+static std::mutex fluid_memory_mutex;
+static std::map<unsigned long, fluid_memory_entry> fluid_memory_images;
+static unsigned long fluid_memory_next_id = 0;
+
+// an image in memory, which the file API opens by name while this lives
+struct fluid_memory_image {
+    fluid_memory_image(const uint8_t *data, size_t size);
+    ~fluid_memory_image();
+    unsigned long id = 0;
+    std::string name;
+};
+
+fluid_memory_image::fluid_memory_image(const uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(fluid_memory_mutex);
+    id = ++fluid_memory_next_id;
+    fluid_memory_entry &ent = fluid_memory_images[id];
+    ent.data = data;
+    ent.size = size;
+
+    char buf[64];
+    sprintf(buf, "%s%lu", fluid_memory_prefix, id);
+    name = buf;
+}
+
+fluid_memory_image::~fluid_memory_image()
+{
+    std::lock_guard<std::mutex> lock(fluid_memory_mutex);
+    fluid_memory_images.erase(id);
+}
+
+static bool fluid_find_memory_image(const char *path, fluid_memory_entry &ent)
+{
+    size_t prefix_length = sizeof(fluid_memory_prefix) - 1;
+    if (strncmp(path, fluid_memory_prefix, prefix_length))
+        return false;
+
+    unsigned long id = 0;
+    char end = '\0';
+    if (sscanf(path + prefix_length, "%lu%c", &id, &end) != 1)
+        return false;
+
+    std::lock_guard<std::mutex> lock(fluid_memory_mutex);
+    auto it = fluid_memory_images.find(id);
+    if (it == fluid_memory_images.end())
+        return false;
+    ent = it->second;
+    return true;
+}
+
+static bool fluid_have_file_mapping()
+{
+    return fluid_host && fluid_host->abi_version >= 6;
+}
+
+static void fluid_init_memory_fileapi(fluid_fileapi_t *fileapi)
+{
+    fileapi->fopen = [](fluid_fileapi_t *, const char *path) -> void *
+    {
+        // otherwise, it is the path of a file which is named alike
+        fluid_memory_entry ent;
+        if (fluid_find_memory_image(path, ent)) {
+            fluid_memory_file *file = new fluid_memory_file;
+            file->data = ent.data;
+            file->size = ent.size;
+            return file;
+        }
+
+        // the synth copies what it reads, so a mapping saves a copy
+        size_t size = 0;
+        const uint8_t *data;
+        if (fluid_have_file_mapping()) {
+            data = (const uint8_t *)fluid_host->file_map(path, &size);
+            if (data)
+                fluid_host->file_advise(data, size, SYNTH_ADVICE_SEQUENTIAL);
+        }
+        else
+            data = (const uint8_t *)fluid_host->file_acquire(path, &size);
+        if (!data)
+            return nullptr;
+        fluid_memory_file *file = new fluid_memory_file;
+        file->data = data;
+        file->size = size;
+        file->shared = true;
+        return file;
+    };
+    fileapi->fread = [](void *buf, int count, void *handle) -> int
+    {
+        fluid_memory_file *file = (fluid_memory_file *)handle;
+        if (count < 0 || (size_t)count > file->size - file->pos)
+            return FLUID_FAILED;
+        memcpy(buf, file->data + file->pos, count);
+        file->pos += count;
+        return FLUID_OK;
+    };
+    fileapi->fseek = [](void *handle, long offset, int origin) -> int
+    {
+        fluid_memory_file *file = (fluid_memory_file *)handle;
+        long base;
+        switch (origin) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = (long)file->pos; break;
+        case SEEK_END: base = (long)file->size; break;
+        default: return FLUID_FAILED;
+        }
+        if (offset < -base || (size_t)(base + offset) > file->size)
+            return FLUID_FAILED;
+        file->pos = (size_t)(base + offset);
+        return FLUID_OK;
+    };
+    fileapi->fclose = [](void *handle) -> int
+    {
+        fluid_memory_file *file = (fluid_memory_file *)handle;
+        if (file->shared)
+            fluid_host->file_release(file->data);
+        delete file;
+        return 0;
+    };
+    fileapi->ftell = [](void *handle) -> long
+    {
+        fluid_memory_file *file = (fluid_memory_file *)handle;
+        return (long)file->pos;
+    };
+}
+
+///
+
+// a soundfont, which is shared by all the synths of the plugin
+struct fluid_shared_sfont {
+    fluid_sfont_t *sfont = nullptr;
+    unsigned refs = 0;
+};
+
+static fluid_sfloader_t *fluid_plugin_sfloader;
+static std::mutex fluid_sfont_mutex;
+static std::map<std::string, fluid_shared_sfont> fluid_sfont_cache;
+
+static fluid_sfont_t *fluid_acquire_sfont(const char *path, unsigned index)
+{
+    File_Info info;
+    if (!fileinfo_utf8(path, info))
+        return nullptr;
+
+    // the synth numbers the soundfonts in the order of addition, so the
+    // index is part of the key, for the shared one to keep the same number
+    char buf[64];
+    sprintf(buf, "\n%llu\n%lld\n%u", (unsigned long long)info.size, (long long)info.mtime, index);
+    std::string key = make_path_canonical(path) + buf;
+
+    std::lock_guard<std::mutex> lock(fluid_sfont_mutex);
+    fluid_shared_sfont &shared = fluid_sfont_cache[key];
+    if (!shared.sfont) {
+        Log::i("[fluid] load soundfont: %s", path);
+        shared.sfont = fluid_plugin_sfloader->load(fluid_plugin_sfloader, path);
+        if (!shared.sfont) {
+            fluid_sfont_cache.erase(key);
+            return nullptr;
+        }
+    }
+    ++shared.refs;
+    return shared.sfont;
+}
+
+static void fluid_release_sfont(fluid_sfont_t *sfont)
+{
+    std::lock_guard<std::mutex> lock(fluid_sfont_mutex);
+    for (auto it = fluid_sfont_cache.begin(), end = fluid_sfont_cache.end(); it != end; ++it) {
+        fluid_shared_sfont &shared = it->second;
+        if (shared.sfont == sfont) {
+            if (--shared.refs == 0) {
+                delete_fluid_sfont(sfont);
+                fluid_sfont_cache.erase(it);
+            }
+            return;
+        }
+    }
+}
+
+static void fluid_synth_release_sfonts(fluid_synth_object *sy)
+{
+    fluid_synth_t *synth = sy->synth.get();
+
+    // take them out, so they are not deleted with the synth
+    for (fluid_sfont_t *sfont : sy->sfonts) {
+        if (synth)
+            fluid_synth_remove_sfont(synth, sfont);
+        fluid_release_sfont(sfont);
+    }
+    sy->sfonts.clear();
+}
+
+///
+
+static bool fluid_have_sample_cache()
+{
+    return fluid_host && fluid_host->abi_version >= 5;
+}
+
+// the presets which are always loaded, for the synth to fall back on
+static void fluid_add_fallback_presets(std::set<uint32_t> &keys)
+{
+    keys.insert(SF2_Subset::preset_key(0, 0));
+    keys.insert(SF2_Subset::preset_key(128, 0));
+}
+
+// the keys of the 14-bit banks, and the requests which may wait for the loader
+static constexpr size_t fluid_preset_key_count = (size_t)1 << 21;
+static constexpr size_t fluid_request_capacity = 256;
+
+static void fluid_set_presets_known(fluid_synth_object *sy, const std::set<uint32_t> &keys)
+{
+    std::vector<uint32_t> &known = sy->presets_known;
+    std::fill(known.begin(), known.end(), 0);
+    for (uint32_t key : keys)
+        known[key / 32] |= (uint32_t)1 << (key % 32);
+}
+
+static std::vector<fluid_sfont_t *> fluid_load_subsets(const fluid_synth_object *sy, const std::vector<uint32_t> &keys)
+{
+    std::vector<fluid_sfont_t *> subsets;
+    std::vector<uint8_t> data;
+
+    for (const std::unique_ptr<fluid_selective_sfont> &sel : sy->selective) {
+        const SF2_Subset &index = sel->index;
+        if (!std::any_of(keys.begin(), keys.end(), [&index](uint32_t key) { return index.has_preset(key); }))
+            continue;
+        if (sel->mapped) {
+            // page in the samples all at once, rather than by faults as they are copied
+            std::vector<SF2_Subset::Range> ranges;
+            if (index.sample_ranges(keys, ranges)) {
+                for (const SF2_Subset::Range &range : ranges)
+                    fluid_host->file_advise(range.data, range.size, SYNTH_ADVICE_WILLNEED);
+            }
+        }
+        if (!index.extract(keys, data)) {
+            Log::e("[fluid] cannot extract the presets of the soundfont");
+            continue;
+        }
+        fluid_memory_image image(data.data(), data.size());
+        if (fluid_sfont_t *sfont = fluid_plugin_sfloader->load(fluid_plugin_sfloader, image.name.c_str()))
+            subsets.push_back(sfont);
+    }
+
+    return subsets;
+}
+
+static void fluid_add_subsets(fluid_synth_object *sy, const std::vector<fluid_sfont_t *> &subsets)
+{
+    // the synth reselects the presets of the channels, and finds the new ones
+    for (fluid_sfont_t *sfont : subsets) {
+        fluid_synth_add_sfont(sy->synth.get(), sfont);
+        sy->subsets.push_back(sfont);
+    }
+}
+
+static void fluid_remove_subsets(fluid_synth_object *sy)
+{
+    fluid_synth_t *synth = sy->synth.get();
+
+    if (sy->subsets.empty())
+        return;
+
+    // stop the voices, which play the samples of these
+    for (unsigned c = 0; c < 16; ++c)
+        fluid_synth_cc(synth, c, 120, 0);
+
+    for (fluid_sfont_t *sfont : sy->subsets) {
+        fluid_synth_remove_sfont(synth, sfont);
+        delete_fluid_sfont(sfont);
+    }
+    sy->subsets.clear();
+}
+
+static void fluid_loader_exec(fluid_synth_object *sy)
+{
+    std::unique_lock<std::mutex> lock(sy->loader_mutex);
+
+    for (;;) {
+        // the audio thread does not notify, the requests are polled
+        Ring_Buffer &requests = *sy->loader_requests;
+        sy->loader_cond.wait_for(lock, std::chrono::milliseconds(10), [sy, &requests] {
+            return sy->loader_quit || requests.size_used() > 0; });
+        if (sy->loader_quit)
+            return;
+
+        std::vector<uint32_t> keys;
+        for (uint32_t key; requests.get(key);) {
+            if (std::any_of(sy->selective.begin(), sy->selective.end(),
+                            [key](const std::unique_ptr<fluid_selective_sfont> &sel) { return sel->index.has_preset(key); }))
+                keys.push_back(key);
+        }
+        if (keys.empty())
+            continue;
+        unsigned generation = sy->loader_generation;
+
+        lock.unlock();
+        std::vector<fluid_sfont_t *> subsets = fluid_load_subsets(sy, keys);
+
+        // the synth before the loader, the order of the audio thread
+        std::unique_lock<std::mutex> synth_lock(sy->synth_mutex);
+        lock.lock();
+
+        // results for a previous song are of no use
+        if (generation != sy->loader_generation) {
+            for (fluid_sfont_t *sfont : subsets)
+                delete_fluid_sfont(sfont);
+            continue;
+        }
+
+        fluid_add_subsets(sy, subsets);
+    }
+}
+
+static bool fluid_start_selective(fluid_synth_object *sy, const char *path)
+{
+    // if mapped, only the samples which are extracted are ever paged in
+    bool map = sy->map_samples && fluid_have_file_mapping();
+
+    size_t size = 0;
+    const uint8_t *image = (const uint8_t *)(map ?
+        fluid_host->file_map(path, &size) : fluid_host->file_acquire(path, &size));
+    if (!image)
+        return false;
+
+    if (map)
+        fluid_host->file_advise(image, size, SYNTH_ADVICE_RANDOM);
+
+    std::unique_ptr<fluid_selective_sfont> sel(new fluid_selective_sfont);
+    sel->image = image;
+    sel->mapped = map;
+    if (!sel->index.parse(image, size)) {
+        Log::w("[fluid] cannot index soundfont: %s", path);
+        fluid_host->file_release(image);
+        return false;
+    }
+
+    Log::i("[fluid] load soundfont selectively: %s", path);
+    sy->selective.push_back(std::move(sel));
+    return true;
+}
+
+static void fluid_stop_selective(fluid_synth_object *sy)
+{
+    if (sy->loader_thread.joinable()) {
+        std::unique_lock<std::mutex> lock(sy->loader_mutex);
+        sy->loader_quit = true;
+        sy->loader_cond.notify_one();
+        lock.unlock();
+        sy->loader_thread.join();
+        sy->loader_quit = false;
+    }
+
+    sy->loader_requests.reset();
+    sy->presets_known.clear();
+    sy->pending_messages.clear();
+    if (sy->dropped_messages > 0) {
+        Log::w("[fluid] dropped %lu messages while the synth was busy", sy->dropped_messages);
+        sy->dropped_messages = 0;
+    }
+
+    if (sy->synth)
+        fluid_remove_subsets(sy);
+
+    for (const std::unique_ptr<fluid_selective_sfont> &sel : sy->selective)
+        fluid_host->file_release(sel->image);
+    sy->selective.clear();
+}
+
+// queue the preset for the loader, unless it is known already;
+// on the audio thread, under the synth lock
+static void fluid_request_preset(fluid_synth_object *sy, uint32_t key)
+{
+    if (key >= fluid_preset_key_count)
+        return;
+
+    uint32_t &word = sy->presets_known[key / 32];
+    uint32_t bit = (uint32_t)1 << (key % 32);
+    if (word & bit)
+        return;
+
+    // if the queue is full, it is requested again at the next selection
+    if (sy->loader_requests->put(key))
+        word |= bit;
+}
+
+// request the preset of the channel, if it is not loaded yet
+static void fluid_check_channel_preset(fluid_synth_object *sy, unsigned channel)
+{
+    unsigned sfont_id = 0, bank = 0, program = 0;
+    if (fluid_synth_get_program(sy->synth.get(), channel, &sfont_id, &bank, &program) != FLUID_OK)
+        return;
+
+    fluid_request_preset(sy, SF2_Subset::preset_key(bank, program));
+    // the synth falls back on bank 0 if the bank does not have the program
+    if (bank != 0 && bank != 128)
+        fluid_request_preset(sy, SF2_Subset::preset_key(0, program));
+}
+
+///
+
 static fluid_fileapi_t fluid_plugin_fileapi;
 
+static void fluid_plugin_set_host(const synth_host_interface *host)
+{
+    fluid_host = host;
+}
+
 static void fluid_plugin_init(const char *base_dir)
 {
     fluid_synth_base_dir.assign(base_dir);
@@ -74,12 +549,18 @@ static void fluid_plugin_init(const char *base_dir)
     fluid_set_log_function(FLUID_PANIC, nullptr, nullptr);
 
     fluid_init_default_fileapi(&fluid_plugin_fileapi);
-    fluid_plugin_fileapi.fopen = [](fluid_fileapi_t *fileapi, const char *path) -> void *
-    {
-        return fopen_utf8(path, "rb");
-    };
+    if (fluid_host && fluid_host->abi_version >= 5)
+        fluid_init_memory_fileapi(&fluid_plugin_fileapi);
+    else {
+        fluid_plugin_fileapi.fopen = [](fluid_fileapi_t *fileapi, const char *path) -> void *
+        {
+            return fopen_utf8(path, "rb");
+        };
+    }
 
     fluid_set_default_fileapi(&fluid_plugin_fileapi);
+
+    fluid_plugin_sfloader = new_fluid_defsfloader();
 }
 
 static void fluid_plugin_shutdown()
@@ -90,6 +571,11 @@ static void fluid_plugin_shutdown()
     fluid_set_log_function(FLUID_INFO, nullptr, nullptr);
     fluid_set_log_function(FLUID_PANIC, nullptr, nullptr);
 
+    if (fluid_plugin_sfloader) {
+        fluid_plugin_sfloader->free(fluid_plugin_sfloader);
+        fluid_plugin_sfloader = nullptr;
+    }
+
     fluid_set_default_fileapi(nullptr);
 }
 
@@ -97,6 +583,8 @@ static const char *default_soundfont_value[] = {"A320U.sf2", nullptr};
 
 static const synth_option the_synth_options[] = {
     {"soundfont", "List of SoundFont files to load", 'm', {.m = default_soundfont_value}},
+    {"selective-loading", "Load only the presets which the song uses", 'b', {.b = true}},
+    {"map-samples", "Map the soundfonts in memory, instead of reading them", 'b', {.b = true}},
     {"chorus-enable", "Enable chorus effect", 'b', {.b = true}},
     {"chorus-voices", "Chorus voice count [0:99]", 'i', {.i = 3}},
     {"chorus-level", "Chorus level [0:10]", 'f', {.f = 2.0}},
@@ -137,6 +625,9 @@ static synth_object *fluid_synth_instantiate(double srate)
 static void fluid_synth_cleanup(synth_object *obj)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
+    if (!sy->selective.empty())
+        fluid_stop_selective(sy);
+    fluid_synth_release_sfonts(sy);
     delete sy;
 }
 
@@ -148,6 +639,7 @@ static int fluid_synth_activate(synth_object *obj)
     if (!synth)
         return -1;
     sy->synth.reset(synth);
+    sy->polyphony = fluid_synth_get_polyphony(synth);
 
     for (char **p = sy->soundfonts.get(), *sf; (sf = *p); ++p) {
         std::string sf_absolute;
@@ -164,10 +656,28 @@ static int fluid_synth_activate(synth_object *obj)
         }
         fclose(fh);
 
-        Log::i("[fluid] load soundfont: %s", sf);
-        int sfid = fluid_synth_sfload(synth, sf, true);
-        if (sfid == -1)
-            /**/;
+        if (sy->selective_loading && fluid_have_sample_cache() && fluid_start_selective(sy, sf))
+            continue;
+
+        fluid_sfont_t *sfont = fluid_acquire_sfont(sf, (unsigned)sy->sfonts.size());
+        if (!sfont) {
+            Log::e("[fluid] cannot load soundfont: %s", sf);
+            continue;
+        }
+        sy->sfonts.push_back(sfont);
+        fluid_synth_add_sfont(synth, sfont);
+    }
+
+    if (!sy->selective.empty()) {
+        // until the song is known, load the fallbacks only
+        std::set<uint32_t> keys;
+        fluid_add_fallback_presets(keys);
+        sy->presets_known.resize(fluid_preset_key_count / 32);
+        fluid_set_presets_known(sy, keys);
+        sy->loader_requests.reset(new Ring_Buffer(fluid_request_capacity * sizeof(uint32_t)));
+        fluid_add_subsets(sy, fluid_load_subsets(sy, std::vector<uint32_t>(keys.begin(), keys.end())));
+        sy->pending_messages.reserve(fluid_pending_capacity);
+        sy->loader_thread = std::thread([sy] { fluid_loader_exec(sy); });
     }
 
     fluid_synth_set_chorus_on(synth, sy->chorus_enable);
@@ -182,17 +692,16 @@ static void fluid_synth_deactivate(synth_object *obj)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
 
+    if (!sy->selective.empty())
+        fluid_stop_selective(sy);
+    fluid_synth_release_sfonts(sy);
     sy->synth.reset();
 }
 
-static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void fluid_write_message(fluid_synth_object *sy, const unsigned char *msg, size_t size)
 {
-    fluid_synth_object *sy = (fluid_synth_object *)obj;
     fluid_synth_t *synth = sy->synth.get();
 
-    if (size < 1)
-        return;
-
     unsigned status = msg[0];
 
     if (status == 0xf0)
@@ -223,6 +732,8 @@ static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_
             break;
         case 0xc0:
             fluid_synth_program_change(synth, channel, data1);
+            if (!sy->selective.empty())
+                fluid_check_channel_preset(sy, channel);
             break;
         case 0xd0:
             fluid_synth_channel_pressure(synth, channel, data1);
@@ -234,12 +745,81 @@ static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_
     }
 }
 
+// sends the messages deferred while the loader held the synth
+static void fluid_flush_pending(fluid_synth_object *sy)
+{
+    std::vector<uint8_t> &pending = sy->pending_messages;
+    for (size_t i = 0, n = pending.size(); i < n;) {
+        uint32_t size;
+        std::memcpy(&size, &pending[i], sizeof(size));
+        fluid_write_message(sy, &pending[i + sizeof(size)], size);
+        i += sizeof(size) + size;
+    }
+    pending.clear();
+}
+
+// applies what came in while the synth was busy, before a block
+static void fluid_apply_requests(fluid_synth_object *sy)
+{
+    fluid_flush_pending(sy);
+    int polyphony = sy->polyphony_request.exchange(0);
+    if (polyphony > 0)
+        fluid_synth_set_polyphony(sy->synth.get(), polyphony);
+}
+
+static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+
+    if (size < 1)
+        return;
+
+    std::unique_lock<std::mutex> lock(sy->synth_mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        fluid_flush_pending(sy);
+        fluid_write_message(sy, msg, size);
+        return;
+    }
+
+    // within the reserved capacity, the vector does not allocate
+    std::vector<uint8_t> &pending = sy->pending_messages;
+    uint32_t size32 = (uint32_t)size;
+    if (pending.size() + sizeof(size32) + size > pending.capacity()) {
+        ++sy->dropped_messages;
+        return;
+    }
+    const uint8_t *size_bytes = (const uint8_t *)&size32;
+    pending.insert(pending.end(), size_bytes, size_bytes + sizeof(size32));
+    pending.insert(pending.end(), msg, msg + size);
+}
+
 static void fluid_synth_generate(synth_object *obj, float *frames, size_t nframes)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
-    fluid_synth_t *synth = sy->synth.get();
 
-    fluid_synth_write_float(synth, nframes, frames, 0, 2, frames, 1, 2);
+    std::unique_lock<std::mutex> lock(sy->synth_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        std::fill(frames, frames + 2 * nframes, 0);
+        return;
+    }
+
+    fluid_apply_requests(sy);
+    fluid_synth_write_float(sy->synth.get(), nframes, frames, 0, 2, frames, 1, 2);
+}
+
+static void fluid_synth_generate_planar(synth_object *obj, float *left, float *right, size_t nframes)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+
+    std::unique_lock<std::mutex> lock(sy->synth_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        std::fill(left, left + nframes, 0);
+        std::fill(right, right + nframes, 0);
+        return;
+    }
+
+    fluid_apply_requests(sy);
+    fluid_synth_write_float(sy->synth.get(), nframes, left, 0, 1, right, 0, 1);
 }
 
 static void fluid_synth_set_option(synth_object *obj, const char *name, synth_value value)
@@ -248,6 +828,10 @@ static void fluid_synth_set_option(synth_object *obj, const char *name, synth_va
 
     if (!strcmp(name, "soundfont"))
         sy->soundfonts = string_list_dup(value.m);
+    else if (!strcmp(name, "selective-loading"))
+        sy->selective_loading = value.b;
+    else if (!strcmp(name, "map-samples"))
+        sy->map_samples = value.b;
     else if (!strcmp(name, "chorus-enable"))
         sy->chorus_enable = value.b;
     else if (!strcmp(name, "chorus-voices"))
@@ -272,6 +856,67 @@ static void fluid_synth_set_option(synth_object *obj, const char *name, synth_va
         sy->reverb_level = value.f;
 }
 
+static void fluid_synth_preload(synth_object *obj, const synth_midi_ins *ins, size_t count)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+
+    if (sy->selective.empty())
+        return;
+
+    std::set<uint32_t> keys;
+    fluid_add_fallback_presets(keys);
+    for (size_t i = 0; i < count; ++i) {
+        synth_midi_ins in = ins[i];
+        if (in.percussive) // the kit is in the bank field
+            keys.insert(SF2_Subset::preset_key(128, in.bank_msb));
+        else {
+            keys.insert(SF2_Subset::preset_key(in.bank_msb, in.program));
+            keys.insert(SF2_Subset::preset_key(in.bank_msb * 128 + in.bank_lsb, in.program));
+            keys.insert(SF2_Subset::preset_key(0, in.program));
+        }
+    }
+
+    // the synth changes here, on the thread of the player, while the host
+    // does not render; the loader waits until it is done
+    std::vector<fluid_sfont_t *> subsets = fluid_load_subsets(sy, std::vector<uint32_t>(keys.begin(), keys.end()));
+
+    std::lock_guard<std::mutex> synth_lock(sy->synth_mutex);
+    std::unique_lock<std::mutex> lock(sy->loader_mutex);
+    ++sy->loader_generation;
+    sy->loader_requests->discard(sy->loader_requests->size_used());
+    fluid_set_presets_known(sy, keys);
+    lock.unlock();
+
+    fluid_flush_pending(sy);
+    fluid_remove_subsets(sy);
+    fluid_add_subsets(sy, subsets);
+}
+
+static void fluid_synth_scale_polyphony(synth_object *obj, double scale)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    int polyphony = std::max(1, (int)(scale * sy->polyphony));
+    // the voices above a lower limit are turned off, at the next block
+    sy->polyphony_request.store(polyphony);
+}
+
+static bool fluid_synth_is_idle(synth_object *obj)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    std::unique_lock<std::mutex> lock(sy->synth_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !sy->pending_messages.empty())
+        return false;
+    // the tails of the effects are not counted, the host waits for their decay
+    return fluid_synth_get_active_voice_count(sy->synth.get()) == 0;
+}
+
+static size_t fluid_synth_block_size(synth_object *, bool *fixed)
+{
+    // the internal block size of the synthesizer (FLUID_BUFSIZE)
+    *fixed = false;
+    return 64;
+}
+
 static const synth_interface the_synth_interface = {
     SYNTH_ABI_VERSION,
     "Fluidsynth",
@@ -285,7 +930,13 @@ static const synth_interface the_synth_interface = {
     &fluid_synth_write,
     &fluid_synth_generate,
     &fluid_synth_set_option,
+    &fluid_synth_preload,
     nullptr,
+    &fluid_synth_block_size,
+    &fluid_plugin_set_host,
+    &fluid_synth_scale_polyphony,
+    &fluid_synth_is_idle,
+    &fluid_synth_generate_planar,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
@@ -4,17 +4,27 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "utility/charset.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #define MT32EMU_API_TYPE 1
 #include <mt32emu.h>
 #include <algorithm>
 #include <string>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <cstdio>
 #include <cstring>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 static constexpr bool mt32emu_debug_enabled = false;
 
+// maximum size of a block rendered at once
+static constexpr size_t mt32emu_frames_max = 512;
+
 ///
 struct mt32emu_context_deleter { void operator()(mt32emu_context x) const noexcept { mt32emu_free_context(x); } };
 typedef std::unique_ptr<mt32emu_data, mt32emu_context_deleter> mt32emu_context_u;
@@ -26,10 +36,114 @@ struct mt32emu_synth_object {
     std::string pcm_rom;
     bool gm_emulation = false;
     int partial_count = 0;
+    bool parallel_devices = false;
     mt32emu_context_u devices[2];
+
+    // the devices are rendered as two jobs of the host, the first into the
+    // output, and the second into its own buffer
+    bool parallel = false;
+    float *job_output = nullptr;
+    size_t job_frames = 0;
+    float second_buffer[2 * mt32emu_frames_max];
+};
+
+///
+// a ROM file, which is read once and given to all the contexts, with the
+// digest which identifies it, not to compute it again
+struct mt32emu_rom_image {
+    std::string key;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    bool shared = false; // from the sample cache of the host
+    std::unique_ptr<uint8_t[]> storage;
+    bool have_digest = false;
+    mt32emu_sha1_digest digest;
 };
 
 static std::string mt32emu_synth_base_dir;
+static const synth_host_interface *mt32emu_host;
+
+static std::mutex mt32emu_rom_mutex;
+static std::list<mt32emu_rom_image> mt32emu_rom_images;
+
+static bool mt32emu_read_rom_file(const char *path, mt32emu_rom_image &image)
+{
+    if (mt32emu_host && mt32emu_host->abi_version >= 6)
+        image.data = (const uint8_t *)mt32emu_host->file_map(path, &image.size);
+    else if (mt32emu_host && mt32emu_host->abi_version >= 5)
+        image.data = (const uint8_t *)mt32emu_host->file_acquire(path, &image.size);
+    if (image.data) {
+        image.shared = true;
+        return true;
+    }
+
+    FILE *fh = fopen_utf8(path, "rb");
+    if (!fh)
+        return false;
+    auto fh_cleanup = gsl::finally([fh] { fclose(fh); });
+
+    if (fseek(fh, 0, SEEK_END) != 0)
+        return false;
+    long length = ftell(fh);
+    if (length < 0 || fseek(fh, 0, SEEK_SET) != 0)
+        return false;
+
+    image.storage.reset(new uint8_t[length ? length : 1]);
+    if (fread(image.storage.get(), 1, length, fh) != (size_t)length)
+        return false;
+
+    image.data = image.storage.get();
+    image.size = (size_t)length;
+    return true;
+}
+
+// the image of the ROM file, which is kept until the plugin shuts down
+static mt32emu_rom_image *mt32emu_acquire_rom(const std::string &path)
+{
+    // a file which changes on disk is a different image
+    File_Info info;
+    if (!fileinfo_utf8(path.c_str(), info))
+        return nullptr;
+
+    char buf[64];
+    sprintf(buf, "\n%llu\n%lld", (unsigned long long)info.size, (long long)info.mtime);
+    std::string key = path + buf;
+
+    std::lock_guard<std::mutex> lock(mt32emu_rom_mutex);
+
+    for (mt32emu_rom_image &image : mt32emu_rom_images) {
+        if (image.key == key)
+            return &image;
+    }
+
+    mt32emu_rom_image image;
+    if (!mt32emu_read_rom_file(path.c_str(), image))
+        return nullptr;
+
+    image.key = std::move(key);
+    mt32emu_rom_images.push_front(std::move(image));
+    return &mt32emu_rom_images.front();
+}
+
+static mt32emu_return_code mt32emu_add_rom(mt32emu_context device, const mt32emu_rom_image &image)
+{
+    std::lock_guard<std::mutex> lock(mt32emu_rom_mutex);
+    return mt32emu_add_rom_data(device, image.data, image.size, image.have_digest ? &image.digest : nullptr);
+}
+
+static void mt32emu_set_rom_digest(mt32emu_rom_image &image, const char *digest)
+{
+    std::lock_guard<std::mutex> lock(mt32emu_rom_mutex);
+    if (image.have_digest || !digest || strlen(digest) != sizeof(image.digest) - 1)
+        return;
+    memcpy(image.digest, digest, sizeof(image.digest));
+    image.have_digest = true;
+}
+
+static void mt32emu_plugin_set_host(const synth_host_interface *host)
+{
+    mt32emu_host = host;
+}
 
 static void mt32emu_plugin_init(const char *base_dir)
 {
@@ -38,6 +152,11 @@ static void mt32emu_plugin_init(const char *base_dir)
 
 static void mt32emu_plugin_shutdown()
 {
+    for (const mt32emu_rom_image &image : mt32emu_rom_images) {
+        if (image.shared)
+            mt32emu_host->file_release(image.data);
+    }
+    mt32emu_rom_images.clear();
 }
 
 static const synth_option the_synth_options[] = {
@@ -45,6 +164,7 @@ static const synth_option the_synth_options[] = {
     {"pcm-rom", "MT-32 PCM ROM file", 's', {.s = "MT32_PCM.ROM"}},
     {"gm-emulation", "Use General MIDI emulation", 'b', {.b = true}},
     {"partial-count", "Number of partials", 'i', {.i = 32}},
+    {"parallel-devices", "Render the two devices in parallel", 'b', {.b = true}},
 };
 
 static const synth_option *mt32emu_plugin_option(size_t index)
@@ -135,17 +255,29 @@ static int mt32emu_synth_activate(synth_object *obj)
     if (!is_path_absolute(pcm_rom))
         pcm_rom = mt32emu_synth_base_dir + pcm_rom;
 
+    // the files are read once, for both devices and the next activations
+    mt32emu_rom_image *control_image = mt32emu_acquire_rom(control_rom);
+    if (!control_image) {
+        Log::e("mt32emu: cannot read control ROM \"%s\"", control_rom.c_str());
+        return -1;
+    }
+    mt32emu_rom_image *pcm_image = mt32emu_acquire_rom(pcm_rom);
+    if (!pcm_image) {
+        Log::e("mt32emu: cannot read PCM ROM \"%s\"", pcm_rom.c_str());
+        return -1;
+    }
+
     for (unsigned devno = 0; devno < 2; ++devno) {
         mt32emu_context device = devices[devno].get();
 
         mt32emu_set_stereo_output_samplerate(device, sy->srate);
         mt32emu_select_renderer_type(device, MT32EMU_RT_FLOAT);
 
-        if (mt32emu_add_rom_file(device, control_rom.c_str()) < 0) {
+        if (mt32emu_add_rom(device, *control_image) < 0) {
             Log::e("mt32emu: cannot add control ROM \"%s\"", control_rom.c_str());
             return -1;
         }
-        if (mt32emu_add_rom_file(device, pcm_rom.c_str()) < 0) {
+        if (mt32emu_add_rom(device, *pcm_image) < 0) {
             Log::e("mt32emu: cannot add PCM ROM \"%s\"", pcm_rom.c_str());
             return -1;
         }
@@ -156,6 +288,8 @@ static int mt32emu_synth_activate(synth_object *obj)
         if (devno == 0) {
             Log::i("mt32emu: using control ROM \"%s\"", rom_info.control_rom_description);
             Log::i("mt32emu: using PCM ROM \"%s\"", rom_info.pcm_rom_description);
+            mt32emu_set_rom_digest(*control_image, rom_info.control_rom_sha1_digest);
+            mt32emu_set_rom_digest(*pcm_image, rom_info.pcm_rom_sha1_digest);
         }
 
         mt32emu_set_midi_event_queue_size(device, 8192);
@@ -183,6 +317,9 @@ static int mt32emu_synth_activate(synth_object *obj)
     for (unsigned devno = 0; devno < 2; ++devno)
         sy->devices[devno] = std::move(devices[devno]);
 
+    sy->parallel = sy->parallel_devices && mt32emu_host && mt32emu_host->abi_version >= 9 &&
+        mt32emu_host->job_concurrency() > 1;
+
     return 0;
 }
 
@@ -194,6 +331,13 @@ static void mt32emu_synth_deactivate(synth_object *obj)
         sy->devices[devno].reset();
 }
 
+static void mt32emu_render_device(void *user_data, size_t devno)
+{
+    mt32emu_synth_object *sy = (mt32emu_synth_object *)user_data;
+    float *output = (devno == 0) ? sy->job_output : sy->second_buffer;
+    mt32emu_render_float(sy->devices[devno].get(), output, sy->job_frames);
+}
+
 static const uint8_t patch_gm_to_mt32[128] = {
     0, // Acoustic Grand Piano -> Acou Piano 1
     1, // Bright Acoustic Piano -> Acou Piano 2
@@ -404,24 +548,41 @@ static void mt32emu_synth_write(synth_object *obj, const unsigned char *msg, siz
     }
 }
 
+// computes dst = gain * (dst + src)
+static void mt32emu_mix(float *dst, const float *src, size_t count, float gain)
+{
+    size_t i = 0;
+#if defined(__SSE__)
+    __m128 vgain = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(&dst[i]), _mm_loadu_ps(&src[i]));
+        _mm_storeu_ps(&dst[i], _mm_mul_ps(sum, vgain));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = gain * (dst[i] + src[i]);
+}
+
 static void mt32emu_synth_generate(synth_object *obj, float *frames, size_t nframes)
 {
     mt32emu_synth_object *sy = (mt32emu_synth_object *)obj;
-    mt32emu_context_u *devices = sy->devices;
-
-    constexpr size_t frames_max = 512;
-    float buffer[2 * frames_max];
 
     const float gain = 0.5f; // need to attenuate a little
 
     while (nframes > 0) {
-        size_t frames_cur = std::min(nframes, frames_max);
-        std::fill(frames, frames + 2 * frames_cur, 0);
-        for (unsigned devno = 0; devno < 2; ++devno) {
-            mt32emu_render_float(devices[devno].get(), buffer, frames_cur);
-            for (size_t i = 0; i < 2 * frames_cur; ++i)
-                frames[i] += gain * buffer[i];
+        size_t frames_cur = std::min(nframes, mt32emu_frames_max);
+
+        sy->job_output = frames;
+        sy->job_frames = frames_cur;
+        if (sy->parallel)
+            mt32emu_host->job_run(&mt32emu_render_device, sy, 2, frames_cur / sy->srate);
+        else {
+            mt32emu_render_device(sy, 0);
+            mt32emu_render_device(sy, 1);
         }
+
+        mt32emu_mix(frames, sy->second_buffer, 2 * frames_cur, gain);
+
         frames += 2 * frames_cur;
         nframes -= frames_cur;
     }
@@ -439,6 +600,33 @@ static void mt32emu_synth_set_option(synth_object *obj, const char *name, synth_
         sy->gm_emulation = value.b;
     else if (!strcmp(name, "partial-count"))
         sy->partial_count = value.i;
+    else if (!strcmp(name, "parallel-devices"))
+        sy->parallel_devices = value.b;
+}
+
+static double mt32emu_plugin_native_rate()
+{
+    // the rate of the MT-32 DAC, at which no internal resampling occurs
+    return 32000;
+}
+
+static size_t mt32emu_synth_block_size(synth_object *, bool *fixed)
+{
+    // large enough to amortize the calls, small enough for MIDI timing
+    *fixed = false;
+    return 128;
+}
+
+static bool mt32emu_synth_is_idle(synth_object *obj)
+{
+    mt32emu_synth_object *sy = (mt32emu_synth_object *)obj;
+
+    // active with queued messages, sounding partials, or reverb
+    for (unsigned devno = 0; devno < 2; ++devno) {
+        if (mt32emu_is_active(sy->devices[devno].get()))
+            return false;
+    }
+    return true;
 }
 
 static const synth_interface the_synth_interface = {
@@ -455,6 +643,12 @@ static const synth_interface the_synth_interface = {
     &mt32emu_synth_generate,
     &mt32emu_synth_set_option,
     nullptr,
+    &mt32emu_plugin_native_rate,
+    &mt32emu_synth_block_size,
+    &mt32emu_plugin_set_host,
+    nullptr,
+    &mt32emu_synth_is_idle,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
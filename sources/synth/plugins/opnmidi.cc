@@ -4,14 +4,26 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "../synth_calibration.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <opnmidi.h>
 #include <algorithm>
+#include <vector>
 #include <memory>
+#include <chrono>
 #include <cstring>
 #include <cctype>
 
+// maximum size of a block rendered at once, when there are several players
+static constexpr size_t opnmidi_frames_max = 512;
+
+// duration of the burst which measures the cost of an emulator (s)
+static constexpr double opnmidi_calibration_time = 0.25;
+// range of the chip count, when it is chosen automatically
+static constexpr int opnmidi_auto_chips_min = 2;
+static constexpr int opnmidi_auto_chips_max = 8;
+
 ///
 struct OPN2_MIDIPlayer_delete { void operator()(OPN2_MIDIPlayer *x) const { opn2_close(x); } };
 typedef std::unique_ptr<OPN2_MIDIPlayer, OPN2_MIDIPlayer_delete> OPN2_MIDIPlayer_u;
@@ -19,30 +31,57 @@ typedef std::unique_ptr<OPN2_MIDIPlayer, OPN2_MIDIPlayer_delete> OPN2_MIDIPlayer
 ///
 struct opnmidi_synth_object {
     double srate = 0;
-    OPN2_MIDIPlayer_u player;
-
     int chip_count = 0;
+    int thread_count = 0;
+    double cpu_budget = 0;
     std::string instrument_bank;
     std::string emulator;
     std::string volume_model;
+
+    // the chips are divided between players, which have their share of the
+    // channels and render as jobs of the host
+    std::vector<OPN2_MIDIPlayer_u> players;
+    uint8_t channel_player[16] = {};
+    std::unique_ptr<float[]> player_buffer;
+    size_t player_frames = 0;
 };
 
+static const synth_host_interface *opnmidi_host;
+
+static void opnmidi_plugin_set_host(const synth_host_interface *host)
+{
+    opnmidi_host = host;
+}
+
+static unsigned opnmidi_job_concurrency()
+{
+    if (!opnmidi_host || opnmidi_host->abi_version < 9)
+        return 1;
+    return opnmidi_host->job_concurrency();
+}
+
 static std::string opnmidi_synth_base_dir;
+static std::unique_ptr<Synth_Calibration> opnmidi_calibration;
 
 static void opnmidi_plugin_init(const char *base_dir)
 {
     opnmidi_synth_base_dir.assign(base_dir);
+    opnmidi_calibration.reset(new Synth_Calibration(
+        opnmidi_synth_base_dir.empty() ? std::string() : (opnmidi_synth_base_dir + "opnmidi-calibration.txt")));
 }
 
 static void opnmidi_plugin_shutdown()
 {
+    opnmidi_calibration.reset();
 }
 
 static const synth_option the_synth_options[] = {
-    {"chip-count", "Number of emulated chips", 'i', {.i = 4}},
+    {"chip-count", "Number of emulated chips, 0 for automatic", 'i', {.i = 4}},
+    {"thread-count", "Threads for the chips [1:16]; above 1, a channel has the chips of one thread, and may sound different", 'i', {.i = 1}},
     {"instrument-bank", "Bank number, or WOPN file path", 's', {.s = "0"}},
-    {"emulator", "Name of the chip emulator", 's', {.s = "mame"}},
+    {"emulator", "Name of the chip emulator, or \"auto\"", 's', {.s = "mame"}},
     {"volume-model", "Name of the volume model", 's', {.s = "auto"}},
+    {"cpu-budget", "Fraction of real time for the chips, when automatic [0:1]", 'f', {.f = 0.5}},
 };
 
 struct named_emulator {
@@ -61,6 +100,15 @@ static const named_emulator the_emulators[] = {
     {"pmdwin", OPNMIDI_EMU_PMDWIN},
 };
 
+// the emulators by decreasing accuracy, for the automatic choice
+static const int the_accurate_emulators[] = {
+    OPNMIDI_EMU_NUKED,
+    OPNMIDI_EMU_MAME,
+    OPNMIDI_EMU_GX,
+    OPNMIDI_EMU_NP2,
+    OPNMIDI_EMU_GENS,
+};
+
 struct named_volume_model {
     const char *name;
     int value;
@@ -98,40 +146,50 @@ static void opnmidi_synth_cleanup(synth_object *obj)
     delete sy;
 }
 
-static int opnmidi_synth_activate(synth_object *obj)
+static std::string opnmidi_str_to_lower(std::string text)
 {
-    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) -> char { return std::tolower(c); });
+    return text;
+}
 
-    OPN2_MIDIPlayer *player = opn2_init(sy->srate);
-    if (!player)
+static const char *opnmidi_emulator_name(int emulator)
+{
+    for (const named_emulator &emu : the_emulators) {
+        if (emu.value == emulator)
+            return emu.name;
+    }
+    return "";
+}
+
+// the emulator named by the options, or -1 if it is automatic
+static int opnmidi_find_emulator(opnmidi_synth_object *sy)
+{
+    const std::string emu_id = opnmidi_str_to_lower(sy->emulator);
+    if (emu_id == "auto")
         return -1;
-    sy->player.reset(player);
 
-    auto str_to_lower = [](std::string text) -> std::string {
-        std::transform(text.begin(), text.end(), text.begin(),
-                       [](unsigned char c) -> char { return std::tolower(c); });
-        return text;
-    };
+    for (const named_emulator &emu : the_emulators) {
+        if (emu_id == emu.name)
+            return emu.value;
+    }
 
-    //
-    int emulator = -1;
-    const unsigned num_emulators = sizeof(the_emulators) / sizeof(the_emulators[0]);
+    Log::e("opnmidi: cannot find an emulator named \"%s\"", sy->emulator.c_str());
+    return the_emulators[0].value;
+}
 
-    const std::string emu_id = str_to_lower(sy->emulator);
-    for (unsigned i = 0; i < num_emulators && emulator == -1; ++i) {
-        if (emu_id == the_emulators[i].name)
-            emulator = the_emulators[i].value;
-    }
-    if (emulator == -1) {
-        Log::e("opnmidi: cannot find an emulator named \"%s\"", sy->emulator.c_str());
-        emulator = the_emulators[0].value;
-    }
+static OPN2_MIDIPlayer_u opnmidi_create_player(opnmidi_synth_object *sy, int emulator, int chip_count)
+{
+    OPN2_MIDIPlayer *player = opn2_init(sy->srate);
+    if (!player)
+        return nullptr;
+    OPN2_MIDIPlayer_u player_u(player);
 
     //
     int volume_model = -1;
     const unsigned num_volume_models = sizeof(the_volume_models) / sizeof(the_volume_models[0]);
 
-    const std::string volmodel_id = str_to_lower(sy->volume_model);
+    const std::string volmodel_id = opnmidi_str_to_lower(sy->volume_model);
     for (unsigned i = 0; i < num_volume_models && volume_model == -1; ++i) {
         if (volmodel_id == the_volume_models[i].name)
             volume_model = the_volume_models[i].value;
@@ -145,8 +203,8 @@ static int opnmidi_synth_activate(synth_object *obj)
     if (opn2_switchEmulator(player, emulator) != 0)
         Log::e("opnmidi: cannot set emulator");
 
-    if (opn2_setNumChips(player, sy->chip_count) != 0)
-        Log::e("opnmidi: cannot set chip count %d", sy->chip_count);
+    if (opn2_setNumChips(player, chip_count) != 0)
+        Log::e("opnmidi: cannot set chip count %d", chip_count);
 
     Log::i("opnmidi: use %d chips \"%s\"", opn2_getNumChips(player), opn2_chipEmulatorName(player));
 
@@ -174,30 +232,164 @@ static int opnmidi_synth_activate(synth_object *obj)
             Log::e("opnmidi: cannot set bank file \"%s\"", path.c_str());
     }
 
+    return player_u;
+}
+
+static void opnmidi_generate_player(OPN2_MIDIPlayer *player, float *frames, size_t nframes);
+
+// the fraction of real time which one chip takes, or -1 on failure
+static double opnmidi_measure_emulator(double srate, int emulator)
+{
+    OPN2_MIDIPlayer_u player(opn2_init(srate));
+    if (!player || opn2_switchEmulator(player.get(), emulator) != 0 ||
+        opn2_setNumChips(player.get(), 1) != 0)
+        return -1;
+
+    // a burst of notes, more than the chip has voices
+    for (unsigned c = 0; c < 16; ++c) {
+        opn2_rt_patchChange(player.get(), c, 8 * c);
+        for (unsigned n = 0; n < 3; ++n)
+            opn2_rt_noteOn(player.get(), c, 36 + 12 * n + c, 100);
+    }
+
+    float buffer[2 * opnmidi_frames_max];
+    opnmidi_generate_player(player.get(), buffer, opnmidi_frames_max);
+
+    size_t total = (size_t)(opnmidi_calibration_time * srate);
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    for (size_t done = 0; done < total;) {
+        size_t count = std::min(total - done, opnmidi_frames_max);
+        opnmidi_generate_player(player.get(), buffer, count);
+        done += count;
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+
+    return elapsed.count() * srate / (double)total;
+}
+
+// choose the emulator and the chip count which are automatic, the most
+// accurate emulator first, then the most chips which fit in the budget
+static void opnmidi_choose_automatic(opnmidi_synth_object *sy, int &emulator, int &chip_count)
+{
+    const int *candidates = the_accurate_emulators;
+    size_t num_candidates = sizeof(the_accurate_emulators) / sizeof(the_accurate_emulators[0]);
+    if (emulator != -1) {
+        candidates = &emulator;
+        num_candidates = 1;
+    }
+
+    int chips_min = (chip_count > 0) ? chip_count : opnmidi_auto_chips_min;
+    int chips_max = (chip_count > 0) ? chip_count : opnmidi_auto_chips_max;
+    int threads = std::max(1, std::min(std::min(sy->thread_count, 16), (int)opnmidi_job_concurrency()));
+    double budget = sy->cpu_budget;
+
+    // the players run in parallel, and the slowest has the most chips
+    auto load_of = [threads](double cost, int chips) -> double {
+        int players = std::min(threads, chips);
+        return cost * (double)((chips + players - 1) / players);
+    };
+
+    int chosen_emulator = -1;
+    int chosen_chips = chips_min;
+    double cheapest = -1;
+    int cheapest_emulator = -1;
+
+    for (size_t i = 0; i < num_candidates && chosen_emulator == -1; ++i) {
+        int emu = candidates[i];
+        double srate = sy->srate;
+        double cost = opnmidi_calibration->cost(
+            opnmidi_emulator_name(emu), srate,
+            [srate, emu]() -> double { return opnmidi_measure_emulator(srate, emu); });
+        if (cost < 0)
+            continue;
+
+        if (cheapest_emulator == -1 || cost < cheapest) {
+            cheapest = cost;
+            cheapest_emulator = emu;
+        }
+
+        if (load_of(cost, chips_min) > budget)
+            continue;
+
+        chosen_emulator = emu;
+        chosen_chips = chips_max;
+        while (chosen_chips > chips_min && load_of(cost, chosen_chips) > budget)
+            --chosen_chips;
+    }
+
+    if (chosen_emulator == -1) {
+        // nothing fits, then take the least costly
+        chosen_emulator = (cheapest_emulator != -1) ? cheapest_emulator : candidates[num_candidates - 1];
+        Log::w("opnmidi: no emulator fits in the processor budget");
+    }
+
+    Log::i("opnmidi: choose %d chips \"%s\" automatically", chosen_chips, opnmidi_emulator_name(chosen_emulator));
+
+    emulator = chosen_emulator;
+    chip_count = chosen_chips;
+}
+
+static int opnmidi_synth_activate(synth_object *obj)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+
+    int emulator = opnmidi_find_emulator(sy);
+    int chip_count = sy->chip_count;
+    if (emulator == -1 || chip_count <= 0)
+        opnmidi_choose_automatic(sy, emulator, chip_count);
+
+    // each player has its share of the chips, and of the channels
+    chip_count = std::max(1, chip_count);
+    int player_count = std::max(1, std::min(std::min(sy->thread_count, 16), chip_count));
+
+    for (int p = 0; p < player_count; ++p) {
+        int chips = chip_count / player_count + ((p < chip_count % player_count) ? 1 : 0);
+        OPN2_MIDIPlayer_u player = opnmidi_create_player(sy, emulator, chips);
+        if (!player) {
+            sy->players.clear();
+            return -1;
+        }
+        sy->players.push_back(std::move(player));
+    }
+
+    // a channel has the chips of its player only, which changes the voice
+    // allocation with the count of players
+    for (unsigned c = 0; c < 16; ++c)
+        sy->channel_player[c] = (uint8_t)(c % player_count);
+
+    if (player_count > 1) {
+        unsigned threads = std::min(opnmidi_job_concurrency(), (unsigned)player_count);
+        Log::i("opnmidi: render the chips in %d parts, on %u threads", player_count, threads);
+        sy->player_buffer.reset(new float[2 * opnmidi_frames_max * player_count]);
+    }
+
     return 0;
 }
 
 static void opnmidi_synth_deactivate(synth_object *obj)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    sy->player.reset();
+    sy->players.clear();
+    sy->player_buffer.reset();
 }
 
 static void opnmidi_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    OPN2_MIDIPlayer *player = sy->player.get();
 
     if (size <= 0)
         return;
 
     unsigned status = msg[0];
     if (status == 0xf0) {
-        opn2_rt_systemExclusive(player, msg, size);
+        for (OPN2_MIDIPlayer_u &player : sy->players)
+            opn2_rt_systemExclusive(player.get(), msg, size);
         return;
     }
 
     unsigned channel = status & 0x0f;
+    OPN2_MIDIPlayer *player = sy->players[sy->channel_player[channel]].get();
     switch (status >> 4) {
     case 0b1001: {
         if (size < 3) break;
@@ -243,11 +435,8 @@ static void opnmidi_synth_write(synth_object *obj, const unsigned char *msg, siz
     }
 }
 
-static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+static void opnmidi_generate_player(OPN2_MIDIPlayer *player, float *frames, size_t nframes)
 {
-    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    OPN2_MIDIPlayer *player = sy->player.get();
-
     OPNMIDI_AudioFormat format;
     format.type = OPNMIDI_SampleType_F32;
     format.containerSize = sizeof(float);
@@ -255,18 +444,70 @@ static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nfra
     opn2_generateFormat(player, 2 * nframes, (OPN2_UInt8 *)frames, (OPN2_UInt8 *)(frames + 1), &format);
 }
 
+static void opnmidi_render_player_job(void *user_data, size_t p)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)user_data;
+    opnmidi_generate_player(sy->players[p].get(), &sy->player_buffer[2 * opnmidi_frames_max * p], sy->player_frames);
+}
+
+static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+    size_t nplayers = sy->players.size();
+
+    if (nplayers == 1) {
+        opnmidi_generate_player(sy->players[0].get(), frames, nframes);
+        return;
+    }
+
+    const float *buffer = sy->player_buffer.get();
+
+    while (nframes > 0) {
+        size_t frames_cur = std::min(nframes, opnmidi_frames_max);
+
+        sy->player_frames = frames_cur;
+        if (opnmidi_job_concurrency() > 1)
+            opnmidi_host->job_run(&opnmidi_render_player_job, sy, nplayers, frames_cur / sy->srate);
+        else {
+            for (size_t p = 0; p < nplayers; ++p)
+                opnmidi_render_player_job(sy, p);
+        }
+
+        // sum in a fixed order, for a result independent of the scheduling
+        std::copy(buffer, buffer + 2 * frames_cur, frames);
+        for (size_t p = 1; p < nplayers; ++p) {
+            const float *part = &buffer[2 * opnmidi_frames_max * p];
+            for (size_t i = 0; i < 2 * frames_cur; ++i)
+                frames[i] += part[i];
+        }
+
+        frames += 2 * frames_cur;
+        nframes -= frames_cur;
+    }
+}
+
 static void opnmidi_synth_set_option(synth_object *obj, const char *name, synth_value value)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
 
     if (!strcmp(name, "chip-count"))
         sy->chip_count = value.i;
+    else if (!strcmp(name, "thread-count"))
+        sy->thread_count = value.i;
     else if (!strcmp(name, "instrument-bank"))
         sy->instrument_bank.assign(value.s);
     else if (!strcmp(name, "emulator"))
         sy->emulator.assign(value.s);
     else if (!strcmp(name, "volume-model"))
         sy->volume_model.assign(value.s);
+    else if (!strcmp(name, "cpu-budget"))
+        sy->cpu_budget = value.f;
+}
+
+static double opnmidi_plugin_native_rate()
+{
+    // the rate of the OPN2 chip, at which no internal resampling occurs
+    return 53267;
 }
 
 static const synth_interface the_synth_interface = {
@@ -283,6 +524,12 @@ static const synth_interface the_synth_interface = {
     &opnmidi_synth_generate,
     &opnmidi_synth_set_option,
     nullptr,
+    &opnmidi_plugin_native_rate,
+    nullptr,
+    &opnmidi_plugin_set_host,
+    nullptr,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
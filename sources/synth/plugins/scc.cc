@@ -10,18 +10,42 @@
 #include <emidi_alpha/CSccDevice.hpp>
 #include <emidi_alpha/COpllDevice.hpp>
 #include <algorithm>
+#include <vector>
 #include <memory>
 #include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// maximum size of a block rendered at once
+static constexpr size_t scc_frames_max = 256;
 
 ///
 struct scc_synth_object {
     double srate = 0;
     unsigned module_count = 0;
+    bool parallel_modules = false;
 
     dsa::CMIDIModule module[16];
     std::unique_ptr<dsa::ISoundDevice> device[16];
+
+    // a message which is reused, not to allocate on every MIDI event
+    dsa::CMIDIMsg message;
+
+    // the blocks of the modules, in stereo interleaved, rendered as jobs of
+    // the host if parallel
+    bool parallel = false;
+    std::unique_ptr<int32_t[]> module_buffer;
+    size_t module_frames = 0;
 };
 
+static const synth_host_interface *scc_host;
+
+static void scc_plugin_set_host(const synth_host_interface *host)
+{
+    scc_host = host;
+}
+
 static void scc_plugin_init(const char *base_dir)
 {
 }
@@ -32,6 +56,7 @@ static void scc_plugin_shutdown()
 
 static const synth_option the_synth_options[] = {
     {"modules-count", "Number of emulated modules (2-16)", 'i', {.i = 4}},
+    {"parallel-modules", "Render the modules in parallel", 'b', {.b = false}},
 };
 
 static const synth_option *scc_plugin_option(size_t index)
@@ -74,6 +99,16 @@ static int scc_synth_activate(synth_object *obj)
         sy->module[m].Reset();
     }
 
+    const uint8_t message_data[2] = {};
+    sy->message = dsa::CMIDIMsg(dsa::CMIDIMsg::UNKNOWN_MESSAGE, 0, message_data, sizeof(message_data));
+
+    sy->module_buffer.reset(new int32_t[2 * scc_frames_max * mods]);
+
+    sy->parallel = sy->parallel_modules && scc_host && scc_host->abi_version >= 9 &&
+        scc_host->job_concurrency() > 1;
+    if (sy->parallel)
+        Log::i("scc: render modules on %u threads", std::min(scc_host->job_concurrency(), mods));
+
     return 0;
 }
 
@@ -83,9 +118,57 @@ static void scc_synth_deactivate(synth_object *obj)
 
     for (unsigned i = 0; i < 16; ++i)
         sy->device[i].reset();
+
+    sy->module_buffer.reset();
+}
+
+static void scc_render_module(scc_synth_object *sy, unsigned m, size_t nframes)
+{
+    dsa::CMIDIModule &mod = sy->module[m];
+    int32_t *block = &sy->module_buffer[2 * scc_frames_max * m];
+
+    for (size_t i = 0; i < nframes; ++i)
+        mod.Render(&block[2 * i]);
+}
+
+static void scc_render_module_job(void *user_data, size_t index)
+{
+    scc_synth_object *sy = (scc_synth_object *)user_data;
+    scc_render_module(sy, (unsigned)index, sy->module_frames);
+}
+
+static void scc_render_modules(scc_synth_object *sy, size_t nframes)
+{
+    unsigned mods = sy->module_count;
+
+    if (!sy->parallel) {
+        for (unsigned m = 0; m < mods; ++m)
+            scc_render_module(sy, m, nframes);
+        return;
+    }
+
+    sy->module_frames = nframes;
+    scc_host->job_run(&scc_render_module_job, sy, mods, nframes / sy->srate);
+}
+
+// converts a block of a module, and adds it to the output
+static void scc_mix(float *dst, const int32_t *src, size_t count)
+{
+    const float gain = 1.0f / 32768;
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128 vgain = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)&src[i]));
+        _mm_storeu_ps(&dst[i], _mm_add_ps(_mm_loadu_ps(&dst[i]), _mm_mul_ps(x, vgain)));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] += src[i] * gain;
 }
 
-static dsa::CMIDIMsg scc_interpret_channel_midi(const unsigned char *msg, size_t size)
+// fills the message, which has room for the data of any channel message
+static bool scc_interpret_channel_midi(const unsigned char *msg, size_t size, dsa::CMIDIMsg &mm)
 {
     dsa::CMIDIMsg::MsgType msgtype = dsa::CMIDIMsg::UNKNOWN_MESSAGE;
     int msgch = 0;
@@ -120,9 +203,13 @@ static dsa::CMIDIMsg scc_interpret_channel_midi(const unsigned char *msg, size_t
     }
 
     if (msgtype == dsa::CMIDIMsg::UNKNOWN_MESSAGE)
-        return dsa::CMIDIMsg();
+        return false;
 
-    return dsa::CMIDIMsg(msgtype, msgch, msg + 1, size - 1);
+    mm.m_type = msgtype;
+    mm.m_ch = msgch;
+    mm.m_data[0] = msg[1];
+    mm.m_data[1] = (size > 2) ? msg[2] : 0;
+    return true;
 }
 
 static void scc_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
@@ -130,10 +217,8 @@ static void scc_synth_write(synth_object *obj, const unsigned char *msg, size_t
     scc_synth_object *sy = (scc_synth_object *)obj;
     unsigned mods = sy->module_count;
 
-    #pragma message("scc MIDI not realtime-safe")
-
-    dsa::CMIDIMsg mm = scc_interpret_channel_midi(msg, size);
-    if (mm.m_type == dsa::CMIDIMsg::UNKNOWN_MESSAGE)
+    dsa::CMIDIMsg &mm = sy->message;
+    if (!scc_interpret_channel_midi(msg, size, mm))
         return;
 
     sy->module[(mm.m_ch * 2) % mods].SendMIDIMsg(mm);
@@ -146,16 +231,18 @@ static void scc_synth_generate(synth_object *obj, float *frames, size_t nframes)
     scc_synth_object *sy = (scc_synth_object *)obj;
     unsigned mods = sy->module_count;
 
-    std::fill(frames, frames + 2 * nframes, 0);
+    while (nframes > 0) {
+        size_t frames_cur = std::min(nframes, scc_frames_max);
 
-    for (unsigned m = 0; m < mods; ++m) {
-        dsa::CMIDIModule &mod = sy->module[m];
-        for (size_t i = 0; i < nframes; ++i) {
-            int32_t b[2];
-            mod.Render(b);
-            frames[2 * i + 0] += b[0] * (1.0f / 32768);
-            frames[2 * i + 1] += b[1] * (1.0f / 32768);
-        }
+        scc_render_modules(sy, frames_cur);
+
+        // sum in a fixed order, for a result independent of the scheduling
+        std::fill(frames, frames + 2 * frames_cur, 0);
+        for (unsigned m = 0; m < mods; ++m)
+            scc_mix(frames, &sy->module_buffer[2 * scc_frames_max * m], 2 * frames_cur);
+
+        frames += 2 * frames_cur;
+        nframes -= frames_cur;
     }
 }
 
@@ -165,6 +252,8 @@ static void scc_synth_set_option(synth_object *obj, const char *name, synth_valu
 
     if (!strcmp(name, "modules-count"))
         sy->module_count = std::min(16L, std::max(2L, value.i));
+    else if (!strcmp(name, "parallel-modules"))
+        sy->parallel_modules = value.b;
 }
 
 static const synth_interface the_synth_interface = {
@@ -181,6 +270,12 @@ static const synth_interface the_synth_interface = {
     &scc_synth_generate,
     &scc_synth_set_option,
     nullptr,
+    nullptr,
+    nullptr,
+    &scc_plugin_set_host,
+    nullptr,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
@@ -5,13 +5,24 @@
 
 #include "../synth.h"
 #include "../synth_utility.h"
+#include "../sf2_subset.h"
 #include "utility/charset.h"
 #include "utility/paths.h"
+#include "utility/memory.h"
 #include "utility/logs.h"
 #include <timiditypp/timidity.h>
 #include <timiditypp/instrum.h>
 #include <timiditypp/playmidi.h>
+#include <algorithm>
+#include <vector>
+#include <list>
+#include <bitset>
+#include <map>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstdarg>
 #include <cstring>
@@ -51,14 +62,440 @@ static void timiditypp_print_message(int type, int verbosity_level, const char*
 }
 
 ///
-struct timiditypp_synth_object {
-    string_list_ptr soundfonts;
+// a soundfont held in the sample cache; if mapped, it is indexed in order to
+// prefetch the samples of the song
+struct timiditypp_image {
+    const void *data = nullptr;
+    std::unique_ptr<SF2_Subset> index;
+};
+
+// an instrument decoded in a set, with the song which used it last
+struct timiditypp_cached_instrument {
+    size_t memory_usage = 0;
+    unsigned long last_use = 0;
+};
+
+// instruments of a soundfont configuration, with the ones decoded so far;
+// these are kept when no synth uses them, to be reused by the next one
+struct timiditypp_instrument_set {
+    std::string config;
+    double srate = 0;
+    unsigned rate_index = 0;
+    std::vector<timiditypp_image> images;
     std::unique_ptr<MusicIO::FileSystemSoundFontReader> reader;
     std::unique_ptr<TimidityPlus::Instruments> instruments;
+    std::map<uint16_t, timiditypp_cached_instrument> precached;
+    // of the configuration alone, and with the instruments
+    size_t base_memory_usage = 0;
+    size_t memory_usage = 0;
+};
+
+typedef std::unique_ptr<timiditypp_instrument_set> timiditypp_instrument_set_u;
+
+struct timiditypp_synth_object {
+    double srate = 0;
+    unsigned rate_index = 0;
+    string_list_ptr soundfonts;
+    bool map_samples = true;
+    double instrument_cache_memory = 0;
+    std::string config;
+    timiditypp_instrument_set_u set;
     std::unique_ptr<TimidityPlus::Player> player;
+
+    // the messages which came while the rate was in use, to send at the next
+    // call which has it; past the capacity, only what ends the notes is kept,
+    // by channel
+    std::vector<uint8_t> pending;
+    bool pending_overflow = false;
+    std::bitset<128> pending_notes_off[16];
+    uint8_t pending_channel_off[16] = {};
+    unsigned long dropped_messages = 0;
+};
+
+enum {
+    Timiditypp_Sustain_Off = 1,
+    Timiditypp_All_Notes_Off = 2,
+    Timiditypp_All_Sound_Off = 4,
 };
 
 static std::string timiditypp_synth_base_dir;
+static const synth_host_interface *timiditypp_host;
+
+static std::mutex timiditypp_cache_mutex;
+static std::list<timiditypp_instrument_set_u> timiditypp_cache; // most recently used first
+static size_t timiditypp_cache_budget = 0;
+// counts the songs, to find the instruments used least recently
+static std::atomic<unsigned long> timiditypp_use_clock{0};
+
+static constexpr size_t timiditypp_pending_capacity = 16 * 1024;
+
+///
+// the playback rate of the library is global, so the instances which run at
+// the same time share the rate. The state is a single atomic word, so the
+// calls at the rate in use always enter, without a lock; a call at another
+// rate waits for the current ones to finish. The audio thread waits for the
+// calls of the audio threads only, which are short, but not for the work in
+// the background at another rate; it skips its call instead.
+static std::atomic<uint64_t> timiditypp_rate_state{0};
+static constexpr uint64_t timiditypp_rate_one_user = (uint64_t)1 << 0;
+static constexpr uint64_t timiditypp_rate_users_mask = ((uint64_t)1 << 20) - 1;
+static constexpr uint64_t timiditypp_rate_one_background = (uint64_t)1 << 20;
+static constexpr uint64_t timiditypp_rate_background_mask = (((uint64_t)1 << 20) - 1) << 20;
+static constexpr unsigned timiditypp_rate_index_shift = 40;
+static constexpr uint64_t timiditypp_rate_switching = (uint64_t)1 << 63;
+
+// the rates of the instances, by index from 1
+static std::mutex timiditypp_rates_mutex;
+static std::vector<double> timiditypp_rates;
+
+static unsigned timiditypp_rate_index(double rate)
+{
+    std::lock_guard<std::mutex> lock(timiditypp_rates_mutex);
+    auto it = std::find(timiditypp_rates.begin(), timiditypp_rates.end(), rate);
+    if (it == timiditypp_rates.end())
+        it = timiditypp_rates.insert(it, rate);
+    return (unsigned)(it - timiditypp_rates.begin()) + 1;
+}
+
+class Timiditypp_Rate_Guard {
+public:
+    Timiditypp_Rate_Guard(double rate, unsigned index, bool background)
+        : user_(background ? (timiditypp_rate_one_user | timiditypp_rate_one_background) : timiditypp_rate_one_user)
+    {
+        uint64_t state = timiditypp_rate_state.load();
+
+        for (;;) {
+            uint64_t users = state & timiditypp_rate_users_mask;
+            unsigned current = (unsigned)((state >> timiditypp_rate_index_shift) & 0xffff);
+            bool switching = (state & timiditypp_rate_switching) != 0;
+
+            if (users == 0) {
+                // the first in sets the rate, the others at this rate wait for it
+                uint64_t next = user_ | ((uint64_t)index << timiditypp_rate_index_shift);
+                if (current != index)
+                    next |= timiditypp_rate_switching;
+                if (timiditypp_rate_state.compare_exchange_weak(state, next)) {
+                    if (current != index) {
+                        TimidityPlus::set_playback_rate(rate);
+                        timiditypp_rate_state.fetch_and(~timiditypp_rate_switching);
+                    }
+                    owns_ = true;
+                    return;
+                }
+                continue;
+            }
+
+            if (current == index && !switching) {
+                if (timiditypp_rate_state.compare_exchange_weak(state, state + user_)) {
+                    owns_ = true;
+                    return;
+                }
+                continue;
+            }
+
+            if (current != index && !background && (state & timiditypp_rate_background_mask))
+                return;
+
+            if (background)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            else
+                std::this_thread::yield();
+            state = timiditypp_rate_state.load();
+        }
+    }
+
+    ~Timiditypp_Rate_Guard()
+    {
+        if (owns_)
+            timiditypp_rate_state.fetch_sub(user_);
+    }
+
+    bool owns_lock() const noexcept
+    {
+        return owns_;
+    }
+
+private:
+    uint64_t user_ = 0;
+    bool owns_ = false;
+
+private:
+    Timiditypp_Rate_Guard(const Timiditypp_Rate_Guard &) = delete;
+    Timiditypp_Rate_Guard &operator=(const Timiditypp_Rate_Guard &) = delete;
+};
+
+static bool timiditypp_have_sample_cache()
+{
+    return timiditypp_host && timiditypp_host->abi_version >= 5;
+}
+
+static bool timiditypp_have_file_mapping()
+{
+    return timiditypp_host && timiditypp_host->abi_version >= 6;
+}
+
+///
+// a file of the sample cache of the host
+class Timiditypp_Shared_Reader : public MusicIO::MemoryReader {
+public:
+    Timiditypp_Shared_Reader(const uint8_t *data, size_t size)
+        : MemoryReader(data, (long)size), data_(data)
+    {
+    }
+
+    ~Timiditypp_Shared_Reader()
+    {
+        timiditypp_host->file_release(data_);
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+};
+
+///
+class Timiditypp_Reader : public MusicIO::FileSystemSoundFontReader {
+public:
+    explicit Timiditypp_Reader(const std::string &config)
+        : FileSystemSoundFontReader("timidity.cfg"), config_(config)
+    {
+    }
+
+    MusicIO::FileInterface *open_file(const char *fn) override
+    {
+        if (!fn)
+            return new MusicIO::MemoryReader(
+                (const uint8_t *)config_.c_str(), (long)config_.size());
+
+        if (timiditypp_have_sample_cache() && is_path_absolute(fn)) {
+            size_t size = 0;
+            const uint8_t *data = (const uint8_t *)timiditypp_host->file_acquire(fn, &size);
+            if (data)
+                return new Timiditypp_Shared_Reader(data, size);
+        }
+
+        return FileSystemSoundFontReader::open_file(fn);
+    }
+
+    void close() override
+    {
+    }
+
+private:
+    std::string config_;
+};
+
+///
+static std::vector<std::string> timiditypp_soundfont_paths(const timiditypp_synth_object *sy)
+{
+    std::vector<std::string> paths;
+
+    for (char **p = sy->soundfonts.get(), *sf; (sf = *p); ++p) {
+        if (is_path_absolute(sf))
+            paths.push_back(sf);
+        else
+            paths.push_back(timiditypp_synth_base_dir + sf);
+    }
+
+    return paths;
+}
+
+static std::string timiditypp_make_config(const timiditypp_synth_object *sy)
+{
+    std::string config;
+    config.reserve(1024);
+
+    for (const std::string &sf : timiditypp_soundfont_paths(sy)) {
+        config.append("soundfont \"");
+        config.append(sf);
+        config.append("\"\n");
+    }
+
+    return config;
+}
+
+static void timiditypp_destroy_set(timiditypp_instrument_set_u set)
+{
+    if (!set)
+        return;
+
+    set->instruments.reset();
+    set->reader.reset();
+    for (const timiditypp_image &image : set->images)
+        timiditypp_host->file_release(image.data);
+}
+
+static timiditypp_instrument_set_u timiditypp_create_set(const timiditypp_synth_object *sy)
+{
+    timiditypp_instrument_set_u set(new timiditypp_instrument_set);
+    set->config = sy->config;
+    set->srate = sy->srate;
+    set->rate_index = sy->rate_index;
+
+    size_t memory_before = get_resident_memory();
+
+    // instruments are loaded as they are needed, so keep the soundfonts in
+    // the cache for as long as the instruments exist
+    // if mapped, only the samples of these instruments are ever paged in
+    if (timiditypp_have_sample_cache()) {
+        bool map = sy->map_samples && timiditypp_have_file_mapping();
+        for (const std::string &sf : timiditypp_soundfont_paths(sy)) {
+            size_t size = 0;
+            const uint8_t *data = (const uint8_t *)(map ?
+                timiditypp_host->file_map(sf.c_str(), &size) : timiditypp_host->file_acquire(sf.c_str(), &size));
+            if (!data)
+                continue;
+            timiditypp_image image;
+            image.data = data;
+            if (map) {
+                timiditypp_host->file_advise(data, size, SYNTH_ADVICE_RANDOM);
+                image.index.reset(new SF2_Subset);
+                if (!image.index->parse(data, size))
+                    image.index.reset();
+            }
+            set->images.push_back(std::move(image));
+        }
+    }
+
+    set->reader.reset(new Timiditypp_Reader(set->config));
+    set->instruments.reset(new TimidityPlus::Instruments);
+
+    if (!set->instruments->load(set->reader.get()))
+        Log::e("[timidity++] cannot load the soundfont configuration");
+
+    size_t memory_after = get_resident_memory();
+    set->base_memory_usage = (memory_after > memory_before) ? (memory_after - memory_before) : 0;
+    set->memory_usage = set->base_memory_usage;
+
+    return set;
+}
+
+// takes the instruments of the configuration from the cache, otherwise loads them
+static timiditypp_instrument_set_u timiditypp_acquire_set(const timiditypp_synth_object *sy)
+{
+    std::unique_lock<std::mutex> lock(timiditypp_cache_mutex);
+
+    for (auto it = timiditypp_cache.begin(), end = timiditypp_cache.end(); it != end; ++it) {
+        if ((*it)->config == sy->config && (*it)->srate == sy->srate) {
+            timiditypp_instrument_set_u set = std::move(*it);
+            timiditypp_cache.erase(it);
+            return set;
+        }
+    }
+
+    lock.unlock();
+    return timiditypp_create_set(sy);
+}
+
+// the library frees its instruments only all at once, since it shares them by
+// name between the banks, so the ones which stay are decoded again; it takes
+// the rate, and the set must have no player at the time
+static void timiditypp_evict_instruments(timiditypp_instrument_set *set, const std::vector<uint16_t> &evicted)
+{
+    size_t evicted_memory = 0;
+    for (uint16_t id : evicted) {
+        auto it = set->precached.find(id);
+        if (it != set->precached.end()) {
+            evicted_memory += it->second.memory_usage;
+            set->precached.erase(it);
+        }
+    }
+    set->memory_usage -= std::min(evicted_memory, set->memory_usage - set->base_memory_usage);
+
+    std::vector<uint16_t> kept;
+    kept.reserve(set->precached.size());
+    for (const auto &entry : set->precached)
+        kept.push_back(entry.first);
+
+    Timiditypp_Rate_Guard rate_guard(set->srate, set->rate_index, true);
+    set->instruments->free_instruments(0);
+    if (!kept.empty())
+        set->instruments->PrecacheInstruments(kept.data(), kept.size());
+}
+
+// evicts the instruments used least recently, except the ones to keep, until
+// the set fits the memory; false if there is none to evict
+static bool timiditypp_trim_set(timiditypp_instrument_set *set, size_t memory, const std::vector<uint16_t> &keep)
+{
+    std::vector<std::pair<unsigned long, uint16_t>> candidates;
+    for (const auto &entry : set->precached) {
+        if (std::find(keep.begin(), keep.end(), entry.first) == keep.end())
+            candidates.emplace_back(entry.second.last_use, entry.first);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    size_t usage = set->memory_usage;
+    std::vector<uint16_t> evicted;
+    for (const auto &candidate : candidates) {
+        if (usage <= memory)
+            break;
+        usage -= std::min(usage, set->precached[candidate.second].memory_usage);
+        evicted.push_back(candidate.second);
+    }
+
+    if (evicted.empty())
+        return false;
+
+    Log::i("[timidity++] evict %lu cached instruments", (unsigned long)evicted.size());
+    timiditypp_evict_instruments(set, evicted);
+    return true;
+}
+
+// gives the instruments back to the cache, and evicts the least recently used,
+// the instruments of the older sets first, then these sets as a whole
+static void timiditypp_release_set(timiditypp_instrument_set_u set)
+{
+    if (!set)
+        return;
+
+    std::list<timiditypp_instrument_set_u> evicted;
+
+    std::unique_lock<std::mutex> lock(timiditypp_cache_mutex);
+
+    size_t budget = timiditypp_cache_budget;
+    timiditypp_cache.push_front(std::move(set));
+
+    for (;;) {
+        size_t total = 0;
+        for (const timiditypp_instrument_set_u &cached : timiditypp_cache)
+            total += cached->memory_usage;
+        if (timiditypp_cache.empty() || (total <= budget && budget > 0))
+            break;
+
+        timiditypp_instrument_set *oldest = timiditypp_cache.back().get();
+        size_t excess = (budget > 0) ? (total - budget) : total;
+        size_t memory = oldest->memory_usage - std::min(excess, oldest->memory_usage);
+        if (budget == 0 || !timiditypp_trim_set(oldest, memory, {}))
+            evicted.splice(evicted.begin(), timiditypp_cache, std::prev(timiditypp_cache.end()));
+    }
+
+    lock.unlock();
+
+    for (timiditypp_instrument_set_u &cached : evicted) {
+        Log::i("[timidity++] evict cached instruments (%lu KiB)", (unsigned long)(cached->memory_usage / 1024));
+        timiditypp_destroy_set(std::move(cached));
+    }
+}
+
+// decodes the instruments which the set does not have, one at a time, to know
+// the memory of each
+static void timiditypp_precache(timiditypp_instrument_set *set, const std::vector<uint16_t> &ids)
+{
+    for (uint16_t id : ids) {
+        if (set->precached.count(id) > 0)
+            continue;
+        size_t memory_before = get_resident_memory();
+        set->instruments->PrecacheInstruments(&id, 1);
+        size_t memory_after = get_resident_memory();
+        size_t usage = (memory_after > memory_before) ? (memory_after - memory_before) : 0;
+        set->precached[id].memory_usage = usage;
+        set->memory_usage += usage;
+    }
+}
+
+static void timiditypp_plugin_set_host(const synth_host_interface *host)
+{
+    timiditypp_host = host;
+}
 
 static void timiditypp_plugin_init(const char *base_dir)
 {
@@ -68,12 +505,21 @@ static void timiditypp_plugin_init(const char *base_dir)
 
 static void timiditypp_plugin_shutdown()
 {
+    std::unique_lock<std::mutex> lock(timiditypp_cache_mutex);
+    std::list<timiditypp_instrument_set_u> cache = std::move(timiditypp_cache);
+    timiditypp_cache.clear();
+    lock.unlock();
+
+    for (timiditypp_instrument_set_u &cached : cache)
+        timiditypp_destroy_set(std::move(cached));
 }
 
 static const char *default_soundfont_value[] = {"A320U.sf2", nullptr};
 
 static const synth_option the_synth_options[] = {
     {"soundfont", "List of SoundFont files to load", 'm', {.m = default_soundfont_value}},
+    {"map-samples", "Map the soundfonts in memory, instead of reading them", 'b', {.b = true}},
+    {"instrument-cache-memory", "Memory for the decoded instruments, kept between songs (MiB)", 'f', {.f = 128}},
 };
 
 static const synth_option *timiditypp_plugin_option(size_t index)
@@ -88,16 +534,18 @@ static synth_object *timiditypp_synth_instantiate(double srate)
     if (!obj)
         return nullptr;
 
+    obj->srate = srate;
+    obj->rate_index = timiditypp_rate_index(srate);
     obj->soundfonts.reset(new char *[1]());
 
-    TimidityPlus::set_playback_rate(srate);
-
     return (synth_object *)obj.release();
 }
 
 static void timiditypp_synth_cleanup(synth_object *obj)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+    sy->player.reset();
+    timiditypp_release_set(std::move(sy->set));
     delete sy;
 }
 
@@ -105,61 +553,32 @@ static int timiditypp_synth_activate(synth_object *obj)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
 
-    TimidityPlus::Instruments *instruments = new TimidityPlus::Instruments;
-    sy->instruments.reset(instruments);
+    std::unique_lock<std::mutex> lock(timiditypp_cache_mutex);
+    double budget = std::max(0.0, std::min(65536.0, sy->instrument_cache_memory));
+    timiditypp_cache_budget = (size_t)(budget * (1 << 20));
+    lock.unlock();
 
-    ///
-    class Reader : public MusicIO::FileSystemSoundFontReader {
-    public:
-        explicit Reader(timiditypp_synth_object &sy)
-            : FileSystemSoundFontReader("timidity.cfg")
-        {
-            std::string &config = config_;
-            config.reserve(1024);
-
-            for (char **p = sy.soundfonts.get(), *sf; (sf = *p); ++p) {
-                std::string sf_absolute;
-                if (!is_path_absolute(sf)) {
-                    sf_absolute = timiditypp_synth_base_dir + sf;
-                    sf = (char *)sf_absolute.c_str();
-                }
-                config.append("soundfont \"");
-                config.append(sf);
-                config.append("\"\n");
-            }
-        }
-
-        MusicIO::FileInterface *open_file(const char *fn) override
-        {
-            if (!fn)
-                return new MusicIO::MemoryReader(
-                    (const uint8_t *)config_.c_str(), (long)config_.size());
-            else
-                return FileSystemSoundFontReader::open_file(fn);
-        }
-
-        void close() override
-        {
-        }
-
-    private:
-        std::string config_;
-    };
-
-    ///
-    Reader *reader = new Reader(*sy);
-    sy->reader.reset(reader);
+    Timiditypp_Rate_Guard rate_guard(sy->srate, sy->rate_index, true);
 
-    if (!instruments->load(reader))
-        Log::e("[timidity++] cannot load the soundfont configuration");
+    sy->config = timiditypp_make_config(sy);
+    sy->set = timiditypp_acquire_set(sy);
 
     ///
-    TimidityPlus::Player *player = new TimidityPlus::Player(instruments);
+    TimidityPlus::Player *player = new TimidityPlus::Player(sy->set->instruments.get());
     sy->player.reset(player);
 
     ///
     player->playmidi_stream_init();
 
+    ///
+    sy->pending.clear();
+    sy->pending.reserve(timiditypp_pending_capacity);
+    sy->pending_overflow = false;
+    for (std::bitset<128> &notes_off : sy->pending_notes_off)
+        notes_off.reset();
+    std::fill(std::begin(sy->pending_channel_off), std::end(sy->pending_channel_off), 0);
+    sy->dropped_messages = 0;
+
     return 0;
 }
 
@@ -167,14 +586,15 @@ static void timiditypp_synth_deactivate(synth_object *obj)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
 
+    if (sy->dropped_messages > 0)
+        Log::w("[timidity++] %lu messages dropped while waiting for the playback rate", sy->dropped_messages);
+
     sy->player.reset();
-    sy->instruments.reset();
-    sy->reader.reset();
+    timiditypp_release_set(std::move(sy->set));
 }
 
-static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void timiditypp_send_message(timiditypp_synth_object *sy, const unsigned char *msg, size_t size)
 {
-    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
     TimidityPlus::Player &player = *sy->player;
 
     uint8_t status = 0;
@@ -198,11 +618,103 @@ static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg,
     }
 }
 
+// keeps a message until the next call which has the rate
+static void timiditypp_defer_message(timiditypp_synth_object *sy, const unsigned char *msg, size_t size)
+{
+    std::vector<uint8_t> &pending = sy->pending;
+
+    if (!sy->pending_overflow && pending.size() + 2 + size <= pending.capacity() && size <= 0xffff) {
+        pending.push_back(size & 0xff);
+        pending.push_back(size >> 8);
+        pending.insert(pending.end(), msg, msg + size);
+        return;
+    }
+
+    // the messages after this one are not kept in order, so none of these goes
+    // in the buffer any more, but what ends the notes is never lost
+    sy->pending_overflow = true;
+
+    unsigned status = (size > 0) ? (msg[0] & 0xf0) : 0;
+    unsigned channel = (size > 0) ? (msg[0] & 0x0f) : 0;
+    if (size >= 3 && (status == 0x80 || (status == 0x90 && msg[2] == 0)))
+        sy->pending_notes_off[channel].set(msg[1] & 127);
+    else if (size >= 3 && status == 0xb0 && msg[1] == 64 && msg[2] < 64)
+        sy->pending_channel_off[channel] |= Timiditypp_Sustain_Off;
+    else if (size >= 3 && status == 0xb0 && msg[1] == 123)
+        sy->pending_channel_off[channel] |= Timiditypp_All_Notes_Off;
+    else if (size >= 3 && status == 0xb0 && msg[1] == 120)
+        sy->pending_channel_off[channel] |= Timiditypp_All_Sound_Off;
+    else
+        ++sy->dropped_messages;
+}
+
+// sends the messages which waited for the rate, the caller having it
+static void timiditypp_flush_pending(timiditypp_synth_object *sy)
+{
+    std::vector<uint8_t> &pending = sy->pending;
+
+    for (size_t i = 0, n = pending.size(); i + 2 <= n;) {
+        size_t size = pending[i] | (pending[i + 1] << 8);
+        timiditypp_send_message(sy, &pending[i + 2], size);
+        i += 2 + size;
+    }
+
+    pending.clear();
+
+    if (!sy->pending_overflow)
+        return;
+
+    TimidityPlus::Player &player = *sy->player;
+    for (unsigned c = 0; c < 16; ++c) {
+        std::bitset<128> &notes_off = sy->pending_notes_off[c];
+        for (unsigned key = 0; key < 128 && notes_off.any(); ++key) {
+            if (notes_off.test(key)) {
+                player.send_event(0x80 | c, key, 0);
+                notes_off.reset(key);
+            }
+        }
+        uint8_t &channel_off = sy->pending_channel_off[c];
+        if (channel_off & Timiditypp_Sustain_Off)
+            player.send_event(0xb0 | c, 64, 0);
+        if (channel_off & Timiditypp_All_Notes_Off)
+            player.send_event(0xb0 | c, 123, 0);
+        if (channel_off & Timiditypp_All_Sound_Off)
+            player.send_event(0xb0 | c, 120, 0);
+        channel_off = 0;
+    }
+
+    sy->pending_overflow = false;
+}
+
+static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+{
+    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+
+    Timiditypp_Rate_Guard rate_guard(sy->srate, sy->rate_index, false);
+    if (!rate_guard.owns_lock()) {
+        timiditypp_defer_message(sy, msg, size);
+        return;
+    }
+
+    timiditypp_flush_pending(sy);
+    timiditypp_send_message(sy, msg, size);
+}
+
 static void timiditypp_synth_generate(synth_object *obj, float *frames, size_t nframes)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
-    TimidityPlus::Player &player = *sy->player;
 
+    // another instance works in the background at another rate, which the
+    // audio thread does not wait for
+    Timiditypp_Rate_Guard rate_guard(sy->srate, sy->rate_index, false);
+    if (!rate_guard.owns_lock()) {
+        std::fill(frames, frames + 2 * nframes, 0.0f);
+        return;
+    }
+
+    timiditypp_flush_pending(sy);
+
+    TimidityPlus::Player &player = *sy->player;
     player.compute_data(frames, nframes);
 }
 
@@ -212,26 +724,75 @@ static void timiditypp_synth_set_option(synth_object *obj, const char *name, syn
 
     if (!strcmp(name, "soundfont"))
         sy->soundfonts = string_list_dup(value.m);
+    else if (!strcmp(name, "map-samples"))
+        sy->map_samples = value.b;
+    else if (!strcmp(name, "instrument-cache-memory"))
+        sy->instrument_cache_memory = value.f;
 }
 
 static void timiditypp_synth_preload(synth_object *obj, const synth_midi_ins *ins, size_t count)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
-    TimidityPlus::Instruments *instruments = sy->instruments.get();
+    timiditypp_instrument_set *set = sy->set.get();
 
-    if (!instruments)
+    if (!set)
         return;
 
-    std::unique_ptr<uint16_t[]> ids(new uint16_t[count]);
-    size_t ids_count = 0;
+    std::vector<uint16_t> ids;
+    ids.reserve(count);
+    std::vector<uint32_t> keys;
+    keys.reserve(count);
 
     for (size_t i = 0; i < count; ++i) {
         synth_midi_ins in = ins[i];
         uint16_t id = (bool(in.percussive) << 14) | ((in.bank_msb & 127) << 7) | (in.program & 127);
-        ids[ids_count++] = id;
+        ids.push_back(id);
+        // the kit is in the bank field
+        keys.push_back(in.percussive ?
+            SF2_Subset::preset_key(128, in.bank_msb) :
+            SF2_Subset::preset_key(in.bank_msb, in.program));
+    }
+
+    // the instruments of the song are the most recently used
+    unsigned long use = ++timiditypp_use_clock;
+    for (uint16_t id : ids) {
+        auto it = set->precached.find(id);
+        if (it != set->precached.end())
+            it->second.last_use = use;
+    }
+
+    // nothing to do if the set has the instruments already
+    if (std::all_of(ids.begin(), ids.end(), [set](uint16_t id) { return set->precached.count(id) > 0; }))
+        return;
+
+    // page in the samples all at once, rather than by faults as they are read
+    for (const timiditypp_image &image : set->images) {
+        std::vector<SF2_Subset::Range> ranges;
+        if (image.index && image.index->sample_ranges(keys, ranges)) {
+            for (const SF2_Subset::Range &range : ranges)
+                timiditypp_host->file_advise(range.data, range.size, SYNTH_ADVICE_WILLNEED);
+        }
+    }
+
+    // this is before the song starts, and the host does not render meanwhile;
+    // under the budget, the instruments of other songs make room for these
+    std::unique_lock<std::mutex> lock(timiditypp_cache_mutex);
+    size_t budget = timiditypp_cache_budget;
+    lock.unlock();
+
+    if (set->memory_usage > budget) {
+        // the voices of the player may use the instruments, so it goes first
+        sy->player.reset();
+        timiditypp_trim_set(set, budget, ids);
+        Timiditypp_Rate_Guard rate_guard(sy->srate, sy->rate_index, true);
+        sy->player.reset(new TimidityPlus::Player(set->instruments.get()));
+        sy->player->playmidi_stream_init();
     }
 
-    instruments->PrecacheInstruments(ids.get(), ids_count);
+    Timiditypp_Rate_Guard rate_guard(sy->srate, sy->rate_index, true);
+    timiditypp_precache(set, ids);
+    for (uint16_t id : ids)
+        set->precached[id].last_use = use;
 }
 
 static const synth_interface the_synth_interface = {
@@ -248,6 +809,12 @@ static const synth_interface the_synth_interface = {
     &timiditypp_synth_generate,
     &timiditypp_synth_set_option,
     &timiditypp_synth_preload,
+    nullptr,
+    nullptr,
+    &timiditypp_plugin_set_host,
+    nullptr,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
@@ -0,0 +1,186 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sample_cache.h"
+#include "synth.h"
+#include "utility/paths.h"
+#include "utility/charset.h"
+#include "utility/realtime.h"
+#include "utility/logs.h"
+#include <cstdio>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Sample_Cache &Sample_Cache::instance()
+{
+    static Sample_Cache cache;
+    return cache;
+}
+
+const uint8_t *Sample_Cache::acquire(gsl::cstring_span path, size_t *size, bool map)
+{
+    std::string canonical = make_path_canonical(path);
+
+    // a file which changes on disk is a different entry
+    File_Info info;
+    if (!fileinfo_utf8(canonical.c_str(), info))
+        return nullptr;
+
+    char buf[64];
+    sprintf(buf, "\n%llu\n%lld", (unsigned long long)info.size, (long long)info.mtime);
+    std::string key = canonical + buf;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // either kind of entry serves both kinds of requests
+    for (Entry &ent : entries_) {
+        if (ent.key == key) {
+            ++ent.refs;
+            *size = ent.size;
+            return ent.data;
+        }
+    }
+
+    // a mapping of locked memory is read in full and pinned, a load is
+    // no worse, and it does not fault if the file is truncated meanwhile
+    if (map && realtime_memory_locked_future())
+        map = false;
+
+    Entry ent;
+    if (map && map_file(canonical, ent.data, ent.size)) {
+        ent.mapped = true;
+        Log::i("Sample cache: map %s (%lu KiB)", canonical.c_str(), (unsigned long)(ent.size / 1024));
+    }
+    else {
+        if (!load_file(canonical, ent.storage, ent.size))
+            return nullptr;
+        ent.data = ent.storage.get();
+        Log::i("Sample cache: load %s (%lu KiB)", canonical.c_str(), (unsigned long)(ent.size / 1024));
+    }
+
+    ent.key = std::move(key);
+    ent.refs = 1;
+    entries_.push_front(std::move(ent));
+
+    *size = entries_.front().size;
+    return entries_.front().data;
+}
+
+void Sample_Cache::release(const void *data)
+{
+    if (!data)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (auto it = entries_.begin(), end = entries_.end(); it != end; ++it) {
+        if (it->data == data) {
+            if (--it->refs == 0) {
+                Log::i("Sample cache: unload %s", it->key.substr(0, it->key.find('\n')).c_str());
+                if (it->mapped)
+                    unmap_file(it->data, it->size);
+                entries_.erase(it);
+            }
+            return;
+        }
+    }
+
+    Log::e("Sample cache: release of unknown data");
+}
+
+bool Sample_Cache::load_file(const std::string &path, std::unique_ptr<uint8_t[]> &data, size_t &size)
+{
+    FILE *fh = fopen_utf8(path.c_str(), "rb");
+    if (!fh)
+        return false;
+    auto fh_cleanup = gsl::finally([fh] { fclose(fh); });
+
+    if (fseek(fh, 0, SEEK_END) != 0)
+        return false;
+    long length = ftell(fh);
+    if (length < 0 || fseek(fh, 0, SEEK_SET) != 0)
+        return false;
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[length ? length : 1]);
+    if (fread(buffer.get(), 1, length, fh) != (size_t)length)
+        return false;
+
+    data = std::move(buffer);
+    size = (size_t)length;
+    return true;
+}
+
+bool Sample_Cache::map_file(const std::string &path, const uint8_t *&data, size_t &size)
+{
+#if !defined(_WIN32)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    auto fd_cleanup = gsl::finally([fd] { close(fd); });
+
+    off_t length = lseek(fd, 0, SEEK_END);
+    if (length <= 0)
+        return false;
+
+    void *addr = mmap(nullptr, (size_t)length, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return false;
+
+    data = (const uint8_t *)addr;
+    size = (size_t)length;
+    return true;
+#else
+    // not implemented, files are loaded instead
+    (void)path;
+    (void)data;
+    (void)size;
+    return false;
+#endif
+}
+
+void Sample_Cache::unmap_file(const uint8_t *data, size_t size)
+{
+#if !defined(_WIN32)
+    munmap((void *)data, size);
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+void Sample_Cache::advise(const void *data, size_t size, int advice)
+{
+#if !defined(_WIN32)
+    // advice is given on whole pages
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+    uintptr_t end = (uintptr_t)data + size;
+
+    int posix_advice;
+    switch (advice) {
+    case SYNTH_ADVICE_WILLNEED:
+        posix_advice = POSIX_MADV_WILLNEED;
+        break;
+    case SYNTH_ADVICE_RANDOM:
+        posix_advice = POSIX_MADV_RANDOM;
+        break;
+    case SYNTH_ADVICE_SEQUENTIAL:
+        posix_advice = POSIX_MADV_SEQUENTIAL;
+        break;
+    default:
+        return;
+    }
+
+    // only a hint, which fails harmlessly on memory which is not mapped
+    posix_madvise((void *)start, end - start, posix_advice);
+#else
+    (void)data;
+    (void)size;
+    (void)advice;
+#endif
+}
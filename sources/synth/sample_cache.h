@@ -0,0 +1,45 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <gsl/gsl>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// Process-wide cache of the data files of synths, such as SoundFonts.
+// A file is loaded once, and shared read-only by all the instances of all
+// plugins, for as long as one of these holds a reference to it.
+// A file can be mapped instead, in which case it is paged in as it is used,
+// unless the memory of the process is locked, which loads it.
+class Sample_Cache {
+public:
+    static Sample_Cache &instance();
+
+    const uint8_t *acquire(gsl::cstring_span path, size_t *size, bool map);
+    void release(const void *data);
+    static void advise(const void *data, size_t size, int advice);
+
+private:
+    Sample_Cache() = default;
+    static bool load_file(const std::string &path, std::unique_ptr<uint8_t[]> &data, size_t &size);
+    static bool map_file(const std::string &path, const uint8_t *&data, size_t &size);
+    static void unmap_file(const uint8_t *data, size_t size);
+
+private:
+    struct Entry {
+        std::string key;
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        unsigned refs = 0;
+        bool mapped = false;
+        std::unique_ptr<uint8_t[]> storage;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+};
@@ -0,0 +1,428 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "sf2_subset.h"
+#include <algorithm>
+#include <unordered_set>
+#include <cstring>
+
+enum {
+    phdr_size = 38,
+    bag_size = 4,
+    mod_size = 10,
+    gen_size = 4,
+    inst_size = 22,
+    shdr_size = 46,
+};
+
+enum {
+    gen_instrument = 41,
+    gen_sample_id = 53,
+};
+
+// zero points which must follow each sample
+static constexpr size_t sample_padding = 46;
+
+static unsigned read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void write16(uint8_t *p, unsigned x)
+{
+    p[0] = x & 0xff;
+    p[1] = (x >> 8) & 0xff;
+}
+
+static void write32(uint8_t *p, uint32_t x)
+{
+    p[0] = x & 0xff;
+    p[1] = (x >> 8) & 0xff;
+    p[2] = (x >> 16) & 0xff;
+    p[3] = x >> 24;
+}
+
+bool SF2_Subset::parse(const uint8_t *data, size_t size)
+{
+    *this = SF2_Subset();
+
+    if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "sfbk", 4))
+        return false;
+
+    size_t riff_size = std::min<size_t>(read32(data + 4), size - 8);
+    const uint8_t *end = data + 8 + riff_size;
+
+    for (const uint8_t *p = data + 12; end - p >= 8;) {
+        size_t chunk_size = read32(p + 4);
+        if (chunk_size > (size_t)(end - p - 8))
+            return false;
+        if (!memcmp(p, "LIST", 4) && chunk_size >= 4) {
+            Chunk list{p, 8 + chunk_size};
+            if (!memcmp(p + 8, "INFO", 4))
+                info_ = list;
+            else if (!parse_list(list))
+                return false;
+        }
+        p += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    // every table has at least its terminal record
+    return info_.data && smpl_.data &&
+        record_count(phdr_, phdr_size) > 0 && record_count(pbag_, bag_size) > 0 &&
+        record_count(pmod_, mod_size) > 0 && record_count(pgen_, gen_size) > 0 &&
+        record_count(inst_, inst_size) > 0 && record_count(ibag_, bag_size) > 0 &&
+        record_count(imod_, mod_size) > 0 && record_count(igen_, gen_size) > 0 &&
+        record_count(shdr_, shdr_size) > 0;
+}
+
+bool SF2_Subset::parse_list(Chunk list)
+{
+    const uint8_t *end = list.data + list.size;
+
+    for (const uint8_t *p = list.data + 12; end - p >= 8;) {
+        size_t chunk_size = read32(p + 4);
+        if (chunk_size > (size_t)(end - p - 8))
+            return false;
+
+        Chunk chunk{p + 8, chunk_size};
+        struct { const char *id; Chunk *chunk; } const known[] = {
+            {"smpl", &smpl_},
+            {"phdr", &phdr_}, {"pbag", &pbag_}, {"pmod", &pmod_}, {"pgen", &pgen_},
+            {"inst", &inst_}, {"ibag", &ibag_}, {"imod", &imod_}, {"igen", &igen_},
+            {"shdr", &shdr_},
+        };
+        for (const auto &k : known) {
+            if (!memcmp(p, k.id, 4))
+                *k.chunk = chunk;
+        }
+
+        p += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    return true;
+}
+
+size_t SF2_Subset::record_count(const Chunk &chunk, size_t record_size)
+{
+    if (!chunk.data || chunk.size % record_size != 0)
+        return 0;
+    return chunk.size / record_size;
+}
+
+bool SF2_Subset::has_preset(uint32_t key) const
+{
+    size_t count = record_count(phdr_, phdr_size) - 1;
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *rec = &phdr_.data[i * phdr_size];
+        if (preset_key(read16(rec + 22), read16(rec + 20)) == key)
+            return true;
+    }
+    return false;
+}
+
+bool SF2_Subset::select(const std::vector<uint32_t> &keys,
+                        std::vector<size_t> &presets, std::vector<size_t> &insts, std::vector<long> &inst_map,
+                        std::vector<size_t> &samples, std::vector<long> &sample_map) const
+{
+    const size_t preset_count = record_count(phdr_, phdr_size) - 1;
+    const size_t pbag_count = record_count(pbag_, bag_size) - 1;
+    const size_t pgen_count = record_count(pgen_, gen_size) - 1;
+    const size_t inst_count = record_count(inst_, inst_size) - 1;
+    const size_t ibag_count = record_count(ibag_, bag_size) - 1;
+    const size_t igen_count = record_count(igen_, gen_size) - 1;
+    const size_t sample_count = record_count(shdr_, shdr_size) - 1;
+
+    presets.clear();
+    insts.clear();
+    samples.clear();
+
+    std::unordered_set<uint32_t> key_set(keys.begin(), keys.end());
+
+    // zone ranges, from the index of an element and of the next one
+    auto bag_range = [](const Chunk &chunk, size_t record_size, size_t offset, size_t index, size_t limit, size_t &first, size_t &last) -> bool {
+        first = read16(&chunk.data[index * record_size + offset]);
+        last = read16(&chunk.data[(index + 1) * record_size + offset]);
+        return first <= last && last <= limit;
+    };
+
+    // select the presets, then what they depend on
+    for (size_t i = 0; i < preset_count; ++i) {
+        const uint8_t *rec = &phdr_.data[i * phdr_size];
+        if (key_set.count(preset_key(read16(rec + 22), read16(rec + 20))))
+            presets.push_back(i);
+    }
+
+    inst_map.assign(inst_count, -1);
+    for (size_t p : presets) {
+        size_t bag_first, bag_last;
+        if (!bag_range(phdr_, phdr_size, 24, p, pbag_count, bag_first, bag_last))
+            return false;
+        for (size_t b = bag_first; b < bag_last; ++b) {
+            size_t gen_first, gen_last;
+            if (!bag_range(pbag_, bag_size, 0, b, pgen_count, gen_first, gen_last))
+                return false;
+            for (size_t g = gen_first; g < gen_last; ++g) {
+                const uint8_t *gen = &pgen_.data[g * gen_size];
+                if (read16(gen) != gen_instrument)
+                    continue;
+                size_t i = read16(gen + 2);
+                if (i >= inst_count)
+                    return false;
+                if (inst_map[i] == -1) {
+                    inst_map[i] = 0;
+                    insts.push_back(i);
+                }
+            }
+        }
+    }
+    std::sort(insts.begin(), insts.end());
+    for (size_t i = 0; i < insts.size(); ++i)
+        inst_map[insts[i]] = (long)i;
+
+    sample_map.assign(sample_count, -1);
+    auto add_sample = [&sample_map, &samples](size_t s) {
+        if (sample_map[s] == -1) {
+            sample_map[s] = 0;
+            samples.push_back(s);
+        }
+    };
+    for (size_t i : insts) {
+        size_t bag_first, bag_last;
+        if (!bag_range(inst_, inst_size, 20, i, ibag_count, bag_first, bag_last))
+            return false;
+        for (size_t b = bag_first; b < bag_last; ++b) {
+            size_t gen_first, gen_last;
+            if (!bag_range(ibag_, bag_size, 0, b, igen_count, gen_first, gen_last))
+                return false;
+            for (size_t g = gen_first; g < gen_last; ++g) {
+                const uint8_t *gen = &igen_.data[g * gen_size];
+                if (read16(gen) != gen_sample_id)
+                    continue;
+                size_t s = read16(gen + 2);
+                if (s >= sample_count)
+                    return false;
+                add_sample(s);
+            }
+        }
+    }
+    // the other channels of the stereo samples
+    for (size_t k = 0; k < samples.size(); ++k) {
+        const uint8_t *rec = &shdr_.data[samples[k] * shdr_size];
+        unsigned type = read16(rec + 44);
+        size_t link = read16(rec + 42);
+        if ((type & 0x7fff) != 1 && link < sample_count)
+            add_sample(link);
+    }
+    std::sort(samples.begin(), samples.end());
+    for (size_t s = 0; s < samples.size(); ++s)
+        sample_map[samples[s]] = (long)s;
+
+    return true;
+}
+
+bool SF2_Subset::sample_ranges(const std::vector<uint32_t> &keys, std::vector<Range> &ranges) const
+{
+    const size_t smpl_points = smpl_.size / 2;
+
+    std::vector<size_t> presets, insts, samples;
+    std::vector<long> inst_map, sample_map;
+    if (!select(keys, presets, insts, inst_map, samples, sample_map))
+        return false;
+
+    ranges.clear();
+    for (size_t s : samples) {
+        const uint8_t *rec = &shdr_.data[s * shdr_size];
+        if (read16(rec + 44) & 0x8000)
+            continue;
+        size_t end = std::min<size_t>(std::max(read32(rec + 24), read32(rec + 32)), smpl_points);
+        size_t start = std::min<size_t>(read32(rec + 20), end);
+        if (start < end)
+            ranges.push_back(Range{&smpl_.data[2 * start], 2 * (end - start)});
+    }
+    return true;
+}
+
+bool SF2_Subset::extract(const std::vector<uint32_t> &keys, std::vector<uint8_t> &output) const
+{
+    const size_t preset_count = record_count(phdr_, phdr_size) - 1;
+    const size_t pmod_count = record_count(pmod_, mod_size) - 1;
+    const size_t inst_count = record_count(inst_, inst_size) - 1;
+    const size_t imod_count = record_count(imod_, mod_size) - 1;
+    const size_t sample_count = record_count(shdr_, shdr_size) - 1;
+    const size_t smpl_points = smpl_.size / 2;
+
+    std::vector<size_t> presets, insts, samples;
+    std::vector<long> inst_map, sample_map;
+    if (!select(keys, presets, insts, inst_map, samples, sample_map))
+        return false;
+
+    ///
+    std::vector<uint8_t> smpl;
+    std::vector<uint8_t> phdr, pbag, pmod, pgen;
+    std::vector<uint8_t> inst, ibag, imod, igen;
+    std::vector<uint8_t> shdr;
+
+    auto append = [](std::vector<uint8_t> &dst, const uint8_t *src, size_t size) -> uint8_t * {
+        size_t offset = dst.size();
+        dst.insert(dst.end(), src, src + size);
+        return &dst[offset];
+    };
+
+    // copy the zones of a preset or instrument, and remap the generator
+    // which refers to the next level
+    auto copy_zones = [&](const Chunk &bags, const Chunk &gens, const Chunk &mods, size_t mod_count,
+                          std::vector<uint8_t> &new_bags, std::vector<uint8_t> &new_gens, std::vector<uint8_t> &new_mods,
+                          size_t bag_first, size_t bag_last, unsigned link_gen, const std::vector<long> &link_map) -> bool
+    {
+        for (size_t b = bag_first; b < bag_last; ++b) {
+            const uint8_t *bag = &bags.data[b * bag_size];
+            const uint8_t *next = bag + bag_size;
+            uint8_t *new_bag = append(new_bags, bag, bag_size);
+            write16(new_bag, (unsigned)(new_gens.size() / gen_size));
+            write16(new_bag + 2, (unsigned)(new_mods.size() / mod_size));
+
+            size_t gen_first = read16(bag), gen_last = read16(next);
+            for (size_t g = gen_first; g < gen_last; ++g) {
+                uint8_t *gen = append(new_gens, &gens.data[g * gen_size], gen_size);
+                if (read16(gen) == link_gen)
+                    write16(gen + 2, (unsigned)link_map[read16(gen + 2)]);
+            }
+            size_t mod_first = read16(bag + 2), mod_last = read16(next + 2);
+            if (mod_first > mod_last || mod_last > mod_count)
+                return false;
+            append(new_mods, &mods.data[mod_first * mod_size], (mod_last - mod_first) * mod_size);
+        }
+        return true;
+    };
+
+    for (size_t p : presets) {
+        const uint8_t *rec = &phdr_.data[p * phdr_size];
+        uint8_t *new_rec = append(phdr, rec, phdr_size);
+        write16(new_rec + 24, (unsigned)(pbag.size() / bag_size));
+        if (!copy_zones(pbag_, pgen_, pmod_, pmod_count, pbag, pgen, pmod,
+                        read16(rec + 24), read16(rec + phdr_size + 24), gen_instrument, inst_map))
+            return false;
+    }
+
+    for (size_t i : insts) {
+        const uint8_t *rec = &inst_.data[i * inst_size];
+        uint8_t *new_rec = append(inst, rec, inst_size);
+        write16(new_rec + 20, (unsigned)(ibag.size() / bag_size));
+        if (!copy_zones(ibag_, igen_, imod_, imod_count, ibag, igen, imod,
+                        read16(rec + 20), read16(rec + inst_size + 20), gen_sample_id, sample_map))
+            return false;
+    }
+
+    for (size_t s : samples) {
+        const uint8_t *rec = &shdr_.data[s * shdr_size];
+        uint8_t *new_rec = append(shdr, rec, shdr_size);
+        unsigned type = read16(rec + 44);
+        size_t link = read16(rec + 42);
+        write16(new_rec + 42, (link < sample_count && sample_map[link] != -1) ? (unsigned)sample_map[link] : 0);
+
+        if (type & 0x8000)
+            continue; // in ROM, not in the sample chunk
+
+        uint32_t start = read32(rec + 20);
+        uint32_t end = read32(rec + 24);
+        uint32_t loop_start = read32(rec + 28);
+        uint32_t loop_end = read32(rec + 32);
+
+        size_t copy_end = std::min<size_t>(std::max(end, loop_end), smpl_points);
+        size_t copy_start = std::min<size_t>(start, copy_end);
+        uint32_t offset = (uint32_t)(smpl.size() / 2);
+        append(smpl, &smpl_.data[2 * copy_start], 2 * (copy_end - copy_start));
+        smpl.resize(smpl.size() + 2 * sample_padding);
+
+        auto relocate = [copy_start, offset](uint32_t x) -> uint32_t {
+            return offset + ((x > copy_start) ? (uint32_t)(x - copy_start) : 0);
+        };
+        write32(new_rec + 20, relocate(start));
+        write32(new_rec + 24, relocate(end));
+        write32(new_rec + 28, relocate(loop_start));
+        write32(new_rec + 32, relocate(loop_end));
+    }
+
+    // terminal records
+    uint8_t *term;
+    term = append(phdr, &phdr_.data[preset_count * phdr_size], phdr_size);
+    write16(term + 24, (unsigned)(pbag.size() / bag_size));
+    term = append(inst, &inst_.data[inst_count * inst_size], inst_size);
+    write16(term + 20, (unsigned)(ibag.size() / bag_size));
+    for (auto *bags : {&pbag, &ibag}) {
+        std::vector<uint8_t> &gens = (bags == &pbag) ? pgen : igen;
+        std::vector<uint8_t> &mods = (bags == &pbag) ? pmod : imod;
+        bags->resize(bags->size() + bag_size);
+        term = &(*bags)[bags->size() - bag_size];
+        write16(term, (unsigned)(gens.size() / gen_size));
+        write16(term + 2, (unsigned)(mods.size() / mod_size));
+    }
+    for (auto *gens : {&pgen, &igen})
+        gens->resize(gens->size() + gen_size);
+    for (auto *mods : {&pmod, &imod})
+        mods->resize(mods->size() + mod_size);
+    append(shdr, &shdr_.data[sample_count * shdr_size], shdr_size);
+
+    // the indices of the file format are 16-bit
+    if (pbag.size() / bag_size > 65536 || pgen.size() / gen_size > 65536 ||
+        pmod.size() / mod_size > 65536 || ibag.size() / bag_size > 65536 ||
+        igen.size() / gen_size > 65536 || imod.size() / mod_size > 65536)
+        return false;
+
+    ///
+    std::vector<uint8_t> &out = output;
+    out.clear();
+
+    auto begin_chunk = [&out](const char *id) -> size_t {
+        size_t offset = out.size();
+        out.insert(out.end(), id, id + 4);
+        out.resize(out.size() + 4);
+        return offset;
+    };
+    auto end_chunk = [&out](size_t offset) {
+        write32(&out[offset + 4], (uint32_t)(out.size() - offset - 8));
+        if (out.size() & 1)
+            out.push_back(0);
+    };
+    auto write_chunk = [&](const char *id, const std::vector<uint8_t> &data) {
+        size_t offset = begin_chunk(id);
+        out.insert(out.end(), data.begin(), data.end());
+        end_chunk(offset);
+    };
+
+    size_t riff = begin_chunk("RIFF");
+    append(out, (const uint8_t *)"sfbk", 4);
+
+    append(out, info_.data, info_.size);
+    if (out.size() & 1)
+        out.push_back(0);
+
+    size_t sdta = begin_chunk("LIST");
+    append(out, (const uint8_t *)"sdta", 4);
+    write_chunk("smpl", smpl);
+    end_chunk(sdta);
+
+    size_t pdta = begin_chunk("LIST");
+    append(out, (const uint8_t *)"pdta", 4);
+    write_chunk("phdr", phdr);
+    write_chunk("pbag", pbag);
+    write_chunk("pmod", pmod);
+    write_chunk("pgen", pgen);
+    write_chunk("inst", inst);
+    write_chunk("ibag", ibag);
+    write_chunk("imod", imod);
+    write_chunk("igen", igen);
+    write_chunk("shdr", shdr);
+    end_chunk(pdta);
+
+    end_chunk(riff);
+    return true;
+}
@@ -0,0 +1,46 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Index of the presets of a SoundFont 2 file in memory, which extracts a
+// selection of these into a new file, with only the samples they need.
+class SF2_Subset {
+public:
+    struct Range {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    static uint32_t preset_key(unsigned bank, unsigned program) { return (bank << 7) | (program & 127); }
+
+    bool parse(const uint8_t *data, size_t size);
+    bool has_preset(uint32_t key) const;
+    bool extract(const std::vector<uint32_t> &keys, std::vector<uint8_t> &output) const;
+    // the sample data which the presets need, in the memory of the file
+    bool sample_ranges(const std::vector<uint32_t> &keys, std::vector<Range> &ranges) const;
+
+private:
+    struct Chunk {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    bool parse_list(Chunk list);
+    bool select(const std::vector<uint32_t> &keys,
+                std::vector<size_t> &presets, std::vector<size_t> &insts, std::vector<long> &inst_map,
+                std::vector<size_t> &samples, std::vector<long> &sample_map) const;
+    static size_t record_count(const Chunk &chunk, size_t record_size);
+
+private:
+    Chunk info_ {}; // whole LIST chunk, with its header
+    Chunk smpl_ {};
+    Chunk phdr_ {}, pbag_ {}, pmod_ {}, pgen_ {};
+    Chunk inst_ {}, ibag_ {}, imod_ {}, igen_ {};
+    Chunk shdr_ {};
+};
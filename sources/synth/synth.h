@@ -18,7 +18,13 @@ extern "C" {
 #endif
 
 enum {
-    SYNTH_ABI_VERSION = 2
+    SYNTH_ABI_VERSION = 10
+};
+
+enum {
+    SYNTH_ADVICE_WILLNEED,
+    SYNTH_ADVICE_RANDOM,
+    SYNTH_ADVICE_SEQUENTIAL,
 };
 
 typedef struct _synth_object synth_object;
@@ -45,6 +51,21 @@ typedef struct _synth_midi_ins {
     unsigned char bank_lsb : 7;
 } synth_midi_ins;
 
+typedef void (synth_job_function)(void *, size_t);
+
+typedef struct _synth_host_interface {
+    unsigned abi_version;
+    // ABI level 5
+    const void *(*file_acquire)(const char *, size_t *);
+    void (*file_release)(const void *);
+    // ABI level 6
+    const void *(*file_map)(const char *, size_t *);
+    void (*file_advise)(const void *, size_t, int);
+    // ABI level 9
+    unsigned (*job_concurrency)(); // threads which run the jobs, the caller included
+    bool (*job_run)(synth_job_function *, void *, size_t, double); // false if late on the deadline (s)
+} synth_host_interface;
+
 typedef struct _synth_interface {
     unsigned abi_version;
     const char *name;
@@ -61,6 +82,18 @@ typedef struct _synth_interface {
     void (*synth_set_option)(synth_object *, const char *, synth_value);
     // ABI level 2
     void (*synth_preload)(synth_object *, const synth_midi_ins *, size_t);
+    // ABI level 3
+    double (*plugin_native_rate)(); // 0 if any
+    // ABI level 4
+    size_t (*synth_block_size)(synth_object *, bool *); // 0 if any, flag set if fixed
+    // ABI level 5
+    void (*plugin_set_host)(const synth_host_interface *); // before plugin_init
+    // ABI level 7
+    void (*synth_scale_polyphony)(synth_object *, double); // fraction ]0:1] of the configured polyphony
+    // ABI level 8
+    bool (*synth_is_idle)(synth_object *); // true if silent until the next message; never paused if null
+    // ABI level 10
+    void (*synth_generate_planar)(synth_object *, float *, float *, size_t); // left, right
 } synth_interface;
 
 typedef const synth_interface *(synth_plugin_entry_fn)();
@@ -0,0 +1,134 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_calibration.h"
+#include "utility/charset.h"
+#include "utility/logs.h"
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+// The file has one entry per line, with tab-separated fields:
+// machine, name, sample rate, cost
+// The entries of other machines are kept, for a configuration directory
+// which would be shared between several of them.
+
+Synth_Calibration::Synth_Calibration(std::string path)
+    : path_(std::move(path)), machine_(get_machine_identifier())
+{
+}
+
+double Synth_Calibration::cost(gsl::cstring_span name, double srate, const std::function<double()> &measure)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!loaded_) {
+        load();
+        loaded_ = true;
+    }
+
+    char buf[64];
+    sprintf(buf, "\t%lu", (unsigned long)srate);
+    std::string key = machine_ + '\t' + gsl::to_string(name) + buf;
+
+    auto it = costs_.find(key);
+    if (it != costs_.end())
+        return it->second;
+
+    double value = measure();
+    if (value < 0)
+        return value;
+
+    Log::i("Calibration: %s at %lu Hz takes %.2f%% of real time",
+           gsl::to_string(name).c_str(), (unsigned long)srate, 100 * value);
+
+    costs_[key] = value;
+    save();
+    return value;
+}
+
+void Synth_Calibration::load()
+{
+    if (path_.empty())
+        return;
+
+    FILE *fh = fopen_utf8(path_.c_str(), "rb");
+    if (!fh)
+        return;
+    auto fh_cleanup = gsl::finally([fh] { fclose(fh); });
+
+    char line[512];
+    while (fgets(line, sizeof(line), fh)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *sep = strrchr(line, '\t');
+        if (!sep)
+            continue;
+        *sep = '\0';
+        char *endp;
+        double value = strtod(sep + 1, &endp);
+        if (endp == sep + 1 || *endp != '\0' || value < 0)
+            continue;
+        costs_[line] = value;
+    }
+}
+
+void Synth_Calibration::save() const
+{
+    if (path_.empty())
+        return;
+
+    FILE *fh = fopen_utf8(path_.c_str(), "wb");
+    if (!fh) {
+        Log::w("Calibration: cannot save %s", path_.c_str());
+        return;
+    }
+    auto fh_cleanup = gsl::finally([fh] { fclose(fh); });
+
+    for (const auto &entry : costs_)
+        fprintf(fh, "%s\t%.9g\n", entry.first.c_str(), entry.second);
+}
+
+std::string get_machine_identifier()
+{
+    std::string model;
+
+#if defined(__linux__)
+    if (FILE *fh = fopen("/proc/cpuinfo", "r")) {
+        auto fh_cleanup = gsl::finally([fh] { fclose(fh); });
+        char line[256];
+        while (model.empty() && fgets(line, sizeof(line), fh)) {
+            if (strncmp(line, "model name", 10) != 0)
+                continue;
+            const char *value = strchr(line, ':');
+            if (!value)
+                continue;
+            value += strspn(value + 1, " ") + 1;
+            model.assign(value, strcspn(value, "\r\n"));
+        }
+    }
+#elif defined(__APPLE__)
+    char brand[256];
+    size_t brand_size = sizeof(brand);
+    if (sysctlbyname("machdep.cpu.brand_string", brand, &brand_size, nullptr, 0) == 0)
+        model.assign(brand, strnlen(brand, brand_size));
+#endif
+
+    if (model.empty())
+        model = "unknown";
+
+    // not a separator of the file
+    for (char &c : model) {
+        if (c == '\t')
+            c = ' ';
+    }
+
+    char buf[64];
+    sprintf(buf, " (%u threads)", std::thread::hardware_concurrency());
+    return model + buf;
+}
@@ -0,0 +1,38 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <gsl/gsl>
+#include <functional>
+#include <string>
+#include <map>
+#include <mutex>
+
+// Costs of the emulators of a synth, measured on this machine.
+// A cost is the fraction of real time which is spent to render one unit, for
+// example one chip, at a given sample rate. It is measured the first time
+// it is needed, and kept in a file for the next runs.
+class Synth_Calibration {
+public:
+    explicit Synth_Calibration(std::string path);
+
+    // the cost, or the result of the measurement if it is not known yet,
+    // which is negative if the measurement fails
+    double cost(gsl::cstring_span name, double srate, const std::function<double()> &measure);
+
+private:
+    void load();
+    void save() const;
+
+private:
+    std::string path_;
+    std::string machine_;
+    bool loaded_ = false;
+    std::map<std::string, double> costs_;
+    std::mutex mutex_;
+};
+
+// a string which identifies the processor of this machine
+std::string get_machine_identifier();
@@ -5,13 +5,23 @@
 
 #include "synth_host.h"
 #include "synth_utility.h"
+#include "sample_cache.h"
 #include "configuration.h"
 #include "utility/paths.h"
 #include "utility/module.h"
 #include "utility/charset.h"
+#include "utility/memory.h"
 #include "utility/logs.h"
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <set>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -25,13 +35,144 @@ static const gsl::cstring_span plugin_suffix = ".dylib";
 static const gsl::cstring_span plugin_suffix = ".so";
 #endif
 
-Synth_Host::Synth_Host()
+// cache of the plugin descriptions, which spares to load them at startup
+static const gsl::cstring_span manifest_name = "plugin-manifest";
+static constexpr long manifest_version = 1;
+
+// maximum number of inactive instances kept warm, independently of memory
+static constexpr size_t cache_max_instances = 8;
+
+// maximum size of the part buffers in parallel mode
+static constexpr size_t part_frames_max = 512;
+// consecutive late slices before parallel rendering is suspended
+static constexpr unsigned parallel_miss_limit = 16;
+// slices rendered serially before parallel rendering is attempted again
+static constexpr unsigned serial_fallback_slices = 4096;
+
+// window over which the governor measures the load of the synth (s)
+static constexpr double governor_window = 0.1;
+// load above which the polyphony is reduced, and below which it is restored
+static constexpr double governor_high_load = 0.8;
+static constexpr double governor_low_load = 0.5;
+// consecutive windows before a reduction, and before a restoration
+static constexpr unsigned governor_cut_windows = 3;
+static constexpr unsigned governor_restore_windows = 30;
+// fraction of the polyphony which remains after each step, and most steps
+static constexpr double governor_step = 0.75;
+static constexpr unsigned governor_cut_max = 4;
+
+// maximum size of the intermediate buffer, when rendering at native rate
+static constexpr size_t resample_frames_max = 256;
+// maximum size of the intermediate buffer, when splitting the channels
+static constexpr size_t planar_frames_max = 256;
+
+// workers which the plugins share, to run the jobs of their blocks
+static std::unique_ptr<Worker_Pool> plugin_workers;
+// a batch at a time, the callers which find it busy run their jobs alone
+static std::mutex plugin_workers_mutex;
+
+static unsigned plugin_job_concurrency()
 {
+    return (plugin_workers ? plugin_workers->thread_count() : 0) + 1;
+}
+
+static bool plugin_job_run(synth_job_function *fn, void *user_data, size_t count, double deadline)
+{
+    std::unique_lock<std::mutex> lock(plugin_workers_mutex, std::try_to_lock);
+    if (lock.owns_lock() && plugin_workers && count > 1)
+        return plugin_workers->run(fn, user_data, count, deadline);
+    lock.unlock();
+
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point start = clock::now();
+    for (size_t index = 0; index < count; ++index)
+        fn(user_data, index);
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return elapsed.count() <= deadline;
+}
+
+// services of the host, which are offered to plugins
+static const synth_host_interface the_host_interface = {
+    SYNTH_ABI_VERSION,
+    [](const char *path, size_t *size) -> const void * { return Sample_Cache::instance().acquire(path, size, false); },
+    [](const void *data) { Sample_Cache::instance().release(data); },
+    [](const char *path, size_t *size) -> const void * { return Sample_Cache::instance().acquire(path, size, true); },
+    &Sample_Cache::advise,
+    &plugin_job_concurrency,
+    &plugin_job_run,
+};
+
+Synth_Host::Synth_Host(bool remote_child)
+{
+    std::unique_ptr<CSimpleIniA> ini = load_global_configuration();
+    if (!ini)
+        ini = create_configuration();
+
+    double cache_memory = ini->GetDoubleValue("", "synth-cache-memory", 256);
+    cache_memory = std::max(0.0, std::min(65536.0, cache_memory));
+    cache_budget_ = (size_t)(cache_memory * (1 << 20));
+
+    long parallel_instances = ini->GetLongValue("", "synth-parallel-instances", 1);
+    parallel_instances_ = (unsigned)std::max(1L, std::min(16L, parallel_instances));
+
+    // a child renders one of the instances, the parent distributes the channels
+    if (remote_child)
+        parallel_instances_ = 1;
+    else if (ini->GetBoolValue("", "synth-isolation", false)) {
+        if (Synth_Remote::is_supported())
+            isolation_ = true;
+        else
+            Log::w("Synth isolation is not supported on this system");
+    }
+
+    std::string partition = ini->GetValue("", "synth-parallel-partition", "interleaved");
+    if (partition == "interleaved")
+        partition_policy_ = Partition_Interleaved;
+    else if (partition == "contiguous")
+        partition_policy_ = Partition_Contiguous;
+    else if (partition == "percussion")
+        partition_policy_ = Partition_Percussion;
+    else
+        Log::w("Unknown synth partition policy: %s", partition.c_str());
+
+    if (isolation_) {
+        Log::i("Isolated synth rendering: %u processes", parallel_instances_);
+        remote_buffer_.reset(new float[2 * Synth_Remote::frames_max]);
+    }
+    else if (parallel_instances_ > 1) {
+        Log::i("Parallel synth rendering: %u instances", parallel_instances_);
+        worker_pool_.reset(new Worker_Pool(parallel_instances_ - 1));
+        part_buffer_.reset(new float[2 * part_frames_max * parallel_instances_]);
+    }
+
+    polyphony_governor_ = ini->GetBoolValue("", "synth-polyphony-governor", true);
+
+    native_rate_ = ini->GetBoolValue("", "synth-native-rate", true);
+    resample_buffer_.reset(new float[2 * resample_frames_max]);
+    planar_buffer_.reset(new float[2 * planar_frames_max]);
+
+    // by default, the processors which the parallel instances leave free;
+    // none in a child, where the other children take the processors
+    if (!plugin_workers && !isolation_) {
+        long plugin_threads = ini->GetLongValue("", "synth-plugin-threads", -1);
+        if (plugin_threads < 0 && remote_child)
+            plugin_threads = 0;
+        else if (plugin_threads < 0) {
+            long processors = (long)std::thread::hardware_concurrency();
+            plugin_threads = processors - (long)parallel_instances_;
+        }
+        plugin_threads = std::max(0L, std::min(15L, plugin_threads));
+        if (plugin_threads > 0) {
+            Log::i("Synth plugin jobs: %ld threads", plugin_threads + 1);
+            plugin_workers.reset(new Worker_Pool((unsigned)plugin_threads));
+        }
+    }
 }
 
 Synth_Host::~Synth_Host()
 {
     unload();
+    clear_cache();
 }
 
 const std::string &Synth_Host::plugin_dir()
@@ -48,6 +189,9 @@ const std::vector<Synth_Host::Plugin_Info> &Synth_Host::plugins()
 
 bool Synth_Host::load(gsl::cstring_span id, double srate)
 {
+    if (isolation_)
+        return load_remote(id, srate);
+
     const std::vector<Plugin_Info> &plugin_list = plugins();
     const Plugin_Info *info = nullptr;
 
@@ -82,100 +226,658 @@ bool Synth_Host::load(gsl::cstring_span id, double srate)
     if (!intf)
         return false;
 
+    std::vector<Option_Value> options = load_synth_options(*info, intf);
+    std::string key = make_instance_key(*info, srate, options);
+
+    if (!current_.parts.empty() && key == current_.key)
+        return true;
+
     unload();
 
-    intf->plugin_init(get_configuration_dir().c_str());
-    module_ = handle;
-    intf_ = intf;
+    for (auto it = cache_.begin(), end = cache_.end(); it != end; ++it) {
+        if (it->key == key) {
+            Log::i("Reuse cached synth instance: %s", info->name.c_str());
+            module_ = handle;
+            current_ = std::move(*it);
+            cache_.erase(it);
+            return true;
+        }
+    }
 
-    synth_object *synth = intf->synth_instantiate(srate);
-    if (!synth)
+    Instance inst;
+    if (!create_instance(intf, srate, options, inst))
         return false;
 
-    bool synth_success = false;
-    auto synth_failure_cleanup = gsl::finally(
-        [&synth_success, intf, synth] { if (!synth_success) intf->synth_cleanup(synth); });
+    module_ = handle;
+    inst.key = std::move(key);
+    current_ = std::move(inst);
+
+    Log::i("Synth instance memory: %lu KiB", (unsigned long)(current_.memory_usage / 1024));
 
-    initial_setup_synth(*info, intf, synth);
+    // make room for this one, in case it has to go in cache later
+    size_t memory_usage = current_.memory_usage;
+    trim_cache((cache_budget_ > memory_usage) ? (cache_budget_ - memory_usage) : 0);
 
-    if (intf->synth_activate(synth) == -1)
+    return true;
+}
+
+bool Synth_Host::load_remote(gsl::cstring_span id, double srate)
+{
+    const Plugin_Info *info = nullptr;
+    for (const Plugin_Info &cur : plugins()) {
+        if (cur.id == id)
+            info = &cur;
+    }
+    if (!info)
         return false;
 
-    synth_ = synth;
-    synth_success = true;
+    // the options are the business of the child, which reads them itself,
+    // but a change of them needs a new child
+    std::string key = make_remote_key(*info, srate);
+
+    if (!remotes_.empty() && key == remote_key_)
+        return true;
+
+    unload();
+
+    std::vector<std::unique_ptr<Synth_Remote>> remotes(parallel_instances_);
+    for (std::unique_ptr<Synth_Remote> &remote : remotes) {
+        remote.reset(new Synth_Remote);
+        if (!remote->start(id, srate))
+            return false;
+    }
+
+    assign_channels(parallel_instances_, remote_channel_);
+    remotes_ = std::move(remotes);
+    remote_key_ = std::move(key);
     return true;
 }
 
 void Synth_Host::unload()
 {
-    synth_object *synth = synth_;
-    const synth_interface *intf = intf_;
+    if (!remotes_.empty()) {
+        remotes_.clear();
+        remote_key_.clear();
+        return;
+    }
+
+    if (current_.parts.empty())
+        return;
 
-    if (synth) {
-        assert(intf);
-        intf->synth_cleanup(synth);
-        synth_ = nullptr;
+    if (total_deadline_misses_ > 0) {
+        Log::w("Parallel synth rendering missed the deadline %lu times", total_deadline_misses_);
+        total_deadline_misses_ = 0;
     }
+    deadline_misses_ = 0;
+    serial_slices_ = 0;
 
-    if (intf) {
-        intf->plugin_shutdown();
-        intf_ = nullptr;
+    if (total_polyphony_cuts_ > 0) {
+        Log::w("Synth polyphony was reduced under load %lu times", total_polyphony_cuts_);
+        total_polyphony_cuts_ = 0;
     }
+    governor_busy_time_ = 0;
+    governor_period_time_ = 0;
+    governor_over_windows_ = 0;
+    governor_under_windows_ = 0;
 
+    Instance inst = std::move(current_);
+    current_ = Instance();
     module_ = nullptr;
+
+    if (inst.memory_usage > cache_budget_) {
+        destroy_instance(inst);
+        return;
+    }
+
+    // silence it while it waits in cache, and restore it in full
+    cut_polyphony(inst, 0);
+    if (inst.resampler)
+        inst.resampler->clear();
+    inst.block_frames = 0;
+    const synth_interface *intf = inst.intf;
+    for (synth_object *synth : inst.parts) {
+        for (unsigned c = 0; c < 16; ++c) {
+            uint8_t all_sound_off[] = {(uint8_t)(0xb0 | c), 120, 0};
+            uint8_t reset_controllers[] = {(uint8_t)(0xb0 | c), 121, 0};
+            intf->synth_write(synth, all_sound_off, sizeof(all_sound_off));
+            intf->synth_write(synth, reset_controllers, sizeof(reset_controllers));
+        }
+    }
+
+    cache_.push_front(std::move(inst));
+    trim_cache(cache_budget_);
+}
+
+void Synth_Host::clear_cache()
+{
+    trim_cache(0);
+}
+
+void Synth_Host::acquire_plugin(const synth_interface *intf)
+{
+    unsigned &users = plugin_users_[intf];
+    if (users++ == 0) {
+        if (intf->abi_version >= 5 && intf->plugin_set_host)
+            intf->plugin_set_host(&the_host_interface);
+        intf->plugin_init(get_configuration_dir().c_str());
+    }
+}
+
+void Synth_Host::release_plugin(const synth_interface *intf)
+{
+    auto it = plugin_users_.find(intf);
+    assert(it != plugin_users_.end() && it->second > 0);
+
+    if (--it->second == 0) {
+        intf->plugin_shutdown();
+        plugin_users_.erase(it);
+    }
+}
+
+bool Synth_Host::create_instance(const synth_interface *intf, double srate, const std::vector<Option_Value> &options, Instance &inst)
+{
+    inst.intf = intf;
+    inst.srate = srate;
+    inst.render_rate = srate;
+
+    if (native_rate_ && intf->abi_version >= 3 && intf->plugin_native_rate) {
+        double native_rate = intf->plugin_native_rate();
+        if (native_rate > 0 && native_rate != srate) {
+            Log::i("Render synth at native rate: %g Hz", native_rate);
+            inst.render_rate = native_rate;
+            inst.resampler.reset(new Sinc_Resampler);
+            inst.resampler->init(native_rate, srate);
+        }
+    }
+
+    acquire_plugin(intf);
+    bool success = false;
+    auto failure_cleanup = gsl::finally(
+        [this, &inst, &success] { if (!success) destroy_instance(inst); });
+
+    size_t memory_before = get_resident_memory();
+
+    for (unsigned i = 0; i < parallel_instances_; ++i) {
+        synth_object *synth = intf->synth_instantiate(inst.render_rate);
+        if (!synth)
+            return false;
+
+        bool synth_success = false;
+        auto synth_failure_cleanup = gsl::finally(
+            [&synth_success, intf, synth] { if (!synth_success) intf->synth_cleanup(synth); });
+
+        apply_synth_options(intf, synth, options);
+
+        if (intf->synth_activate(synth) == -1)
+            return false;
+
+        inst.parts.push_back(synth);
+        synth_success = true;
+    }
+
+    // an estimate, the resident memory of the whole process also changes by
+    // the other threads, and by the files which are shared with other instances
+    size_t memory_after = get_resident_memory();
+    inst.memory_usage = (memory_after > memory_before) ? (memory_after - memory_before) : 0;
+
+    if (intf->abi_version >= 4 && intf->synth_block_size) {
+        bool fixed = false;
+        size_t block_size = intf->synth_block_size(inst.parts[0], &fixed);
+        if (block_size > 1) {
+            if (block_size > part_frames_max) {
+                Log::w("Synth block size too large: %lu", (unsigned long)block_size);
+                block_size = part_frames_max;
+            }
+            Log::i("Render synth by blocks of %lu frames (%s)", (unsigned long)block_size, fixed ? "fixed" : "preferred");
+            inst.block_size = block_size;
+            inst.block_fixed = fixed;
+            inst.block_buffer.reset(new float[2 * block_size]);
+        }
+    }
+
+    assign_channels((unsigned)inst.parts.size(), inst.channel_part);
+    success = true;
+    return true;
+}
+
+void Synth_Host::destroy_instance(Instance &inst)
+{
+    if (!inst.intf)
+        return;
+
+    for (synth_object *synth : inst.parts)
+        inst.intf->synth_cleanup(synth);
+    inst.parts.clear();
+    inst.resampler.reset();
+    release_plugin(inst.intf);
+    inst.intf = nullptr;
+}
+
+void Synth_Host::trim_cache(size_t budget)
+{
+    size_t total = 0;
+    for (const Instance &inst : cache_)
+        total += inst.memory_usage;
+
+    while (!cache_.empty() && (total > budget || cache_.size() > cache_max_instances || budget == 0)) {
+        Instance &inst = cache_.back();
+        Log::i("Evict cached synth instance (%lu KiB)", (unsigned long)(inst.memory_usage / 1024));
+        total -= inst.memory_usage;
+        destroy_instance(inst);
+        cache_.pop_back();
+    }
+}
+
+void Synth_Host::assign_channels(unsigned nparts, uint8_t channel_part[16]) const
+{
+    for (unsigned c = 0; c < 16; ++c) {
+        unsigned part = 0;
+        switch (partition_policy_) {
+        case Partition_Interleaved:
+            part = c % nparts;
+            break;
+        case Partition_Contiguous:
+            part = c * nparts / 16;
+            break;
+        case Partition_Percussion:
+            // the GM drum channel has its own part, the others share the rest
+            if (nparts < 2)
+                part = 0;
+            else if (c == 9)
+                part = 0;
+            else
+                part = 1 + (c - (c > 9)) % (nparts - 1);
+            break;
+        }
+        channel_part[c] = (uint8_t)part;
+    }
 }
 
 void Synth_Host::generate(float *buffer, size_t nframes)
 {
-    synth_object *synth = synth_;
-    const synth_interface *intf = intf_;
+    if (!remotes_.empty()) {
+        generate_remote(buffer, nframes);
+        return;
+    }
+
+    const Instance &inst = current_;
 
-    if (!synth) {
+    if (inst.parts.empty()) {
         std::fill(buffer, buffer + 2 * nframes, 0);
         return;
     }
 
+    const synth_interface *intf = inst.intf;
+    if (!polyphony_governor_ || intf->abi_version < 7 || !intf->synth_scale_polyphony) {
+        generate_current(buffer, nframes);
+        return;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    generate_current(buffer, nframes);
+    std::chrono::duration<double> elapsed = clock::now() - start;
+
+    govern_polyphony(elapsed.count(), nframes / inst.srate);
+}
+
+void Synth_Host::generate_planar(float *left, float *right, size_t nframes)
+{
+    const Instance &inst = current_;
+    const synth_interface *intf = inst.intf;
+
+    // the plugin renders the channels directly, unless the host has to
+    // process its output; in that case, the host splits them in one pass
+    bool direct = remotes_.empty() && inst.parts.size() == 1 && !inst.resampler &&
+        (inst.block_size == 0 || (!inst.block_fixed && inst.block_frames == 0)) &&
+        intf->abi_version >= 10 && intf->synth_generate_planar;
+
+    if (!direct) {
+        float *buffer = planar_buffer_.get();
+        while (nframes > 0) {
+            size_t nframes_current = std::min(nframes, planar_frames_max);
+            generate(buffer, nframes_current);
+            for (size_t i = 0; i < nframes_current; ++i) {
+                left[i] = buffer[2 * i];
+                right[i] = buffer[2 * i + 1];
+            }
+            left += nframes_current;
+            right += nframes_current;
+            nframes -= nframes_current;
+        }
+        return;
+    }
+
+    synth_object *synth = inst.parts[0];
+    if (!polyphony_governor_ || intf->abi_version < 7 || !intf->synth_scale_polyphony) {
+        intf->synth_generate_planar(synth, left, right, nframes);
+        return;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    intf->synth_generate_planar(synth, left, right, nframes);
+    std::chrono::duration<double> elapsed = clock::now() - start;
+
+    govern_polyphony(elapsed.count(), nframes / inst.srate);
+}
+
+void Synth_Host::generate_current(float *buffer, size_t nframes)
+{
+    const Instance &inst = current_;
+
+    if (inst.resampler) {
+        generate_resampled(buffer, nframes);
+        return;
+    }
+
+    generate_native(buffer, nframes);
+}
+
+void Synth_Host::generate_resampled(float *buffer, size_t nframes)
+{
+    Sinc_Resampler &resampler = *current_.resampler;
+    float *resample_buffer = resample_buffer_.get();
+
+    while (nframes > 0) {
+        size_t nframes_current = std::min(nframes, resample_frames_max);
+
+        // pull from the synth as much as the resampler needs
+        size_t nframes_input = resampler.input_needed(nframes_current);
+        while (nframes_input > 0) {
+            size_t nframes_block = std::min(nframes_input, resample_frames_max);
+            generate_native(resample_buffer, nframes_block);
+            resampler.write(resample_buffer, nframes_block);
+            nframes_input -= nframes_block;
+        }
+
+        resampler.read(buffer, nframes_current);
+        buffer += 2 * nframes_current;
+        nframes -= nframes_current;
+    }
+}
+
+void Synth_Host::generate_native(float *buffer, size_t nframes)
+{
+    Instance &inst = current_;
+    size_t block_size = inst.block_size;
+
+    if (block_size == 0) {
+        generate_parts(buffer, nframes);
+        return;
+    }
+
+    // adapt the requested size to the block size, with the help of a FIFO
+    float *block = inst.block_buffer.get();
+
+    while (nframes > 0) {
+        size_t nframes_current;
+
+        if (inst.block_frames > 0) {
+            nframes_current = std::min(nframes, inst.block_frames);
+            const float *pending = &block[2 * (block_size - inst.block_frames)];
+            std::copy(pending, pending + 2 * nframes_current, buffer);
+            inst.block_frames -= nframes_current;
+        }
+        else if (nframes >= block_size) {
+            // whole blocks go directly to the output
+            if (inst.block_fixed)
+                nframes_current = block_size;
+            else {
+                nframes_current = std::min(nframes, part_frames_max);
+                nframes_current -= nframes_current % block_size;
+            }
+            generate_parts(buffer, nframes_current);
+        }
+        else {
+            generate_parts(block, block_size);
+            inst.block_frames = block_size;
+            continue;
+        }
+
+        buffer += 2 * nframes_current;
+        nframes -= nframes_current;
+    }
+}
+
+void Synth_Host::generate_parts(float *buffer, size_t nframes)
+{
+    const Instance &inst = current_;
+    size_t nparts = inst.parts.size();
+    const synth_interface *intf = inst.intf;
     assert(intf);
-    intf->synth_generate(synth, buffer, nframes);
+
+    if (nparts == 1) {
+        intf->synth_generate(inst.parts[0], buffer, nframes);
+        return;
+    }
+
+    generate_parallel(buffer, nframes);
+}
+
+void Synth_Host::generate_parallel(float *buffer, size_t nframes)
+{
+    const Instance &inst = current_;
+    const synth_interface *intf = inst.intf;
+    size_t nparts = inst.parts.size();
+    float *part_buffer = part_buffer_.get();
+
+    while (nframes > 0) {
+        size_t nframes_current = std::min(nframes, part_frames_max);
+        part_frames_ = nframes_current;
+
+        if (serial_slices_ > 0) {
+            --serial_slices_;
+            for (size_t i = 0; i < nparts; ++i)
+                intf->synth_generate(inst.parts[i], &part_buffer[2 * part_frames_max * i], nframes_current);
+        }
+        else {
+            double deadline = nframes_current / inst.render_rate;
+            if (worker_pool_->run(&generate_part, this, nparts, deadline))
+                deadline_misses_ = 0;
+            else {
+                ++total_deadline_misses_;
+                // the workers do not keep up, fall back to serial for a while
+                if (++deadline_misses_ >= parallel_miss_limit) {
+                    deadline_misses_ = 0;
+                    serial_slices_ = serial_fallback_slices;
+                }
+            }
+        }
+
+        // sum in a fixed order, for a result independent of the scheduling
+        std::copy(part_buffer, part_buffer + 2 * nframes_current, buffer);
+        for (size_t i = 1; i < nparts; ++i) {
+            const float *part = &part_buffer[2 * part_frames_max * i];
+            for (size_t j = 0; j < 2 * nframes_current; ++j)
+                buffer[j] += part[j];
+        }
+
+        buffer += 2 * nframes_current;
+        nframes -= nframes_current;
+    }
+}
+
+void Synth_Host::generate_part(void *user_data, size_t index)
+{
+    Synth_Host *self = reinterpret_cast<Synth_Host *>(user_data);
+    const Instance &inst = self->current_;
+    float *part = &self->part_buffer_[2 * part_frames_max * index];
+    inst.intf->synth_generate(inst.parts[index], part, self->part_frames_);
+}
+
+void Synth_Host::generate_remote(float *buffer, size_t nframes)
+{
+    size_t nremotes = remotes_.size();
+    float *remote_buffer = remote_buffer_.get();
+
+    while (nframes > 0) {
+        size_t nframes_current = std::min(nframes, Synth_Remote::frames_max);
+
+        // all children render at once, each in its process
+        for (size_t i = 0; i < nremotes; ++i)
+            remotes_[i]->request(nframes_current);
+
+        // sum in a fixed order, for a result independent of the scheduling
+        remotes_[0]->receive(buffer, nframes_current);
+        for (size_t i = 1; i < nremotes; ++i) {
+            remotes_[i]->receive(remote_buffer, nframes_current);
+            for (size_t j = 0; j < 2 * nframes_current; ++j)
+                buffer[j] += remote_buffer[j];
+        }
+
+        buffer += 2 * nframes_current;
+        nframes -= nframes_current;
+    }
+}
+
+void Synth_Host::govern_polyphony(double busy_time, double period_time)
+{
+    governor_busy_time_ += busy_time;
+    governor_period_time_ += period_time;
+    if (governor_period_time_ < governor_window)
+        return;
+
+    double load = governor_busy_time_ / governor_period_time_;
+    governor_busy_time_ = 0;
+    governor_period_time_ = 0;
+
+    // reduce quickly under overload, restore slowly once the load is low,
+    // and keep the polyphony as it is in between
+    Instance &inst = current_;
+    if (load > governor_high_load) {
+        governor_under_windows_ = 0;
+        if (++governor_over_windows_ >= governor_cut_windows) {
+            governor_over_windows_ = 0;
+            if (inst.polyphony_cut < governor_cut_max) {
+                cut_polyphony(inst, inst.polyphony_cut + 1);
+                ++total_polyphony_cuts_;
+            }
+        }
+    }
+    else if (load < governor_low_load) {
+        governor_over_windows_ = 0;
+        if (++governor_under_windows_ >= governor_restore_windows) {
+            governor_under_windows_ = 0;
+            if (inst.polyphony_cut > 0)
+                cut_polyphony(inst, inst.polyphony_cut - 1);
+        }
+    }
+    else {
+        governor_over_windows_ = 0;
+        governor_under_windows_ = 0;
+    }
+}
+
+void Synth_Host::cut_polyphony(Instance &inst, unsigned cut)
+{
+    const synth_interface *intf = inst.intf;
+    if (cut == inst.polyphony_cut || intf->abi_version < 7 || !intf->synth_scale_polyphony)
+        return;
+
+    double scale = std::pow(governor_step, (double)cut);
+    for (synth_object *synth : inst.parts)
+        intf->synth_scale_polyphony(synth, scale);
+    inst.polyphony_cut = cut;
+}
+
+bool Synth_Host::is_idle() const
+{
+    if (!remotes_.empty()) {
+        for (const std::unique_ptr<Synth_Remote> &remote : remotes_) {
+            if (!remote->is_idle())
+                return false;
+        }
+        return true;
+    }
+
+    const Instance &inst = current_;
+    const synth_interface *intf = inst.intf;
+
+    if (inst.parts.empty())
+        return true;
+
+    // without the query, voices may still sound in a quiet block
+    if (intf->abi_version < 8 || !intf->synth_is_idle)
+        return false;
+
+    for (synth_object *synth : inst.parts) {
+        if (!intf->synth_is_idle(synth))
+            return false;
+    }
+    return true;
 }
 
 void Synth_Host::send_midi(const uint8_t *data, unsigned len)
 {
-    synth_object *synth = synth_;
-    const synth_interface *intf = intf_;
+    if (!remotes_.empty() && len > 0) {
+        if (data[0] < 0xf0)
+            remotes_[remote_channel_[data[0] & 0x0f]]->send_midi(data, len);
+        else {
+            for (const std::unique_ptr<Synth_Remote> &remote : remotes_)
+                remote->send_midi(data, len);
+        }
+        return;
+    }
+
+    const Instance &inst = current_;
+    size_t nparts = inst.parts.size();
 
-    if (!synth)
+    if (nparts == 0 || len == 0)
         return;
 
+    const synth_interface *intf = inst.intf;
     assert(intf);
-    intf->synth_write(synth, data, len);
+
+    uint8_t status = data[0];
+    if (status < 0xf0) {
+        // channel message, to the part which owns the channel
+        synth_object *synth = inst.parts[inst.channel_part[status & 0x0f]];
+        intf->synth_write(synth, data, len);
+    }
+    else {
+        // system message, to all parts
+        for (synth_object *synth : inst.parts)
+            intf->synth_write(synth, data, len);
+    }
 }
 
 bool Synth_Host::can_preload() const
 {
-    synth_object *synth = synth_;
-    const synth_interface *intf = intf_;
+    // the children check it themselves
+    if (!remotes_.empty())
+        return true;
+
+    const Instance &inst = current_;
 
-    if (!synth)
+    if (inst.parts.empty())
         return false;
 
+    const synth_interface *intf = inst.intf;
     assert(intf);
     return intf->abi_version >= 2 && intf->synth_preload;
 }
 
 void Synth_Host::preload(gsl::span<const synth_midi_ins> instruments)
 {
-    synth_object *synth = synth_;
-    const synth_interface *intf = intf_;
+    if (!remotes_.empty()) {
+        for (const std::unique_ptr<Synth_Remote> &remote : remotes_)
+            remote->preload(instruments);
+        return;
+    }
+
+    const Instance &inst = current_;
 
-    if (!synth)
+    if (inst.parts.empty())
         return;
 
+    const synth_interface *intf = inst.intf;
     assert(intf);
     if (intf->abi_version < 2 || !intf->synth_preload)
         return;
 
-    intf->synth_preload(synth, instruments.data(), instruments.size());
+    for (synth_object *synth : inst.parts)
+        intf->synth_preload(synth, instruments.data(), instruments.size());
 }
 
 std::string Synth_Host::find_plugin_dir()
@@ -213,6 +915,16 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
     if (!dh)
         return plugins;
 
+    std::unique_ptr<CSimpleIniA> manifest = load_configuration(manifest_name);
+    bool manifest_update = false;
+    if (!manifest || manifest->GetLongValue("", "version", 0) != manifest_version) {
+        manifest = create_configuration();
+        manifest->SetLongValue("", "version", manifest_version);
+        manifest_update = true;
+    }
+
+    std::set<std::string> paths;
+
     for (std::string name; dh.read_next(name);) {
         size_t namelen = name.size();
 
@@ -224,25 +936,63 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
             gsl::cstring_span(name).subspan(namelen - suffixlen) == plugin_suffix)
         {
             gsl::cstring_span id = gsl::cstring_span(name).subspan(prefixlen, namelen - prefixlen - suffixlen);
-            Dl_Handle_U handle(Dl_open((dir + name.data()).c_str()));
-            synth_plugin_entry_fn *entry = nullptr;
-            const synth_interface *intf = nullptr;
-            if (handle)
-                entry = reinterpret_cast<synth_plugin_entry_fn *>(
-                    Dl_sym(handle.get(), "synth_plugin_entry"));
-            if (entry)
-                intf = entry();
-            if (intf) {
-                Log::s("Synth plugin found: %s", intf->name);
-                Plugin_Info info;
-                info.id = std::string(id.data(), id.size());
-                info.name = intf->name;
-                initial_setup_plugin(info, *intf);
+            std::string path = dir + name;
+
+            File_Info file;
+            if (!fileinfo_utf8(path.c_str(), file))
+                continue;
+
+            paths.insert(path);
+
+            Plugin_Info info;
+            std::vector<Option_Description> options;
+            bool valid;
+
+            if (read_manifest_entry(*manifest, path, file, info, options)) {
+                valid = true;
+                // restore the default settings, if the user has deleted them
+                if (filemode_utf8(get_configuration_file("s_" + info.id).c_str()) == -1)
+                    initial_setup_plugin(info, options);
+            }
+            else {
+                Log::i("Inspect synth plugin: %s", name.c_str());
+                valid = scan_plugin_file(path, id, info, options);
+                // a failure is not recorded, it may come from a dependency
+                // which is missing, and which the user can install later
+                if (valid) {
+                    initial_setup_plugin(info, options);
+                    write_manifest_entry(*manifest, path, file, info, options);
+                    manifest_update = true;
+                }
+                else if (manifest->GetSection(path.c_str())) {
+                    manifest->Delete(path.c_str(), nullptr);
+                    manifest_update = true;
+                }
+            }
+
+            if (valid) {
+                Log::s("Synth plugin found: %s", info.name.c_str());
                 plugins.emplace_back(std::move(info));
             }
         }
     }
 
+    // forget the plugins which are no longer installed
+    CSimpleIniA::TNamesDepend sections;
+    manifest->GetAllSections(sections);
+    std::vector<std::string> stale;
+    for (const CSimpleIniA::Entry &section : sections) {
+        if (section.pItem[0] != '\0' && paths.find(section.pItem) == paths.end())
+            stale.emplace_back(section.pItem);
+    }
+    for (const std::string &section : stale) {
+        manifest->Delete(section.c_str(), nullptr);
+        manifest_update = true;
+    }
+
+    if (manifest_update)
+        save_configuration(manifest_name, *manifest);
+
     std::sort(
         plugins.begin(), plugins.end(),
         [](const Plugin_Info &a, const Plugin_Info &b) -> bool { return a.name < b.name; });
@@ -250,6 +1000,154 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
     return plugins;
 }
 
+bool Synth_Host::scan_plugin_file(const std::string &path, gsl::cstring_span id, Plugin_Info &info, std::vector<Option_Description> &options)
+{
+    Dl_Handle_U handle(Dl_open(path.c_str()));
+    if (!handle)
+        return false;
+
+    synth_plugin_entry_fn *entry = reinterpret_cast<synth_plugin_entry_fn *>(
+        Dl_sym(handle.get(), "synth_plugin_entry"));
+    if (!entry)
+        return false;
+
+    const synth_interface *intf = entry();
+    if (!intf)
+        return false;
+
+    info.id = gsl::to_string(id);
+    info.name = intf->name;
+    info.abi_version = intf->abi_version;
+    options = describe_plugin_options(*intf);
+    return true;
+}
+
+bool Synth_Host::read_manifest_entry(const CSimpleIniA &manifest, const std::string &path, const File_Info &file, Plugin_Info &info, std::vector<Option_Description> &options)
+{
+    const char *section = path.c_str();
+
+    const char *size = manifest.GetValue(section, "size");
+    const char *mtime = manifest.GetValue(section, "mtime");
+    if (!size || !mtime)
+        return false;
+
+    char buf[32];
+    sprintf(buf, "%llu", (unsigned long long)file.size);
+    if (strcmp(size, buf) != 0)
+        return false;
+    sprintf(buf, "%lld", (long long)file.mtime);
+    if (strcmp(mtime, buf) != 0)
+        return false;
+
+    // an entry without identifier is from an older scan, which recorded the
+    // invalid plugins; it is inspected again
+    info.id = manifest.GetValue(section, "id", "");
+    if (info.id.empty())
+        return false;
+    info.name = manifest.GetValue(section, "name", "");
+    info.abi_version = (unsigned)manifest.GetLongValue(section, "abi", 0);
+
+    long count = manifest.GetLongValue(section, "option-count", 0);
+    options.clear();
+    options.reserve(count);
+
+    for (long i = 0; i < count; ++i) {
+        std::string prefix = "option-" + std::to_string(i) + "-";
+        Option_Description od;
+        od.name = manifest.GetValue(section, (prefix + "name").c_str(), "");
+        od.description = manifest.GetValue(section, (prefix + "description").c_str(), "");
+        od.type = manifest.GetValue(section, (prefix + "type").c_str(), "")[0];
+
+        CSimpleIniA::TNamesDepend values;
+        manifest.GetAllValues(section, (prefix + "initial").c_str(), values);
+        values.sort(CSimpleIniA::Entry::LoadOrder());
+        for (const CSimpleIniA::Entry &ent : values)
+            od.initial.emplace_back(ent.pItem);
+
+        if (od.name.empty() || !strchr("ifbsm", od.type) || (od.type != 'm' && od.initial.size() != 1))
+            return false;
+
+        options.push_back(std::move(od));
+    }
+
+    return true;
+}
+
+void Synth_Host::write_manifest_entry(CSimpleIniA &manifest, const std::string &path, const File_Info &file, const Plugin_Info &info, const std::vector<Option_Description> &options)
+{
+    const char *section = path.c_str();
+    manifest.Delete(section, nullptr);
+
+    char buf[32];
+    sprintf(buf, "%llu", (unsigned long long)file.size);
+    manifest.SetValue(section, "size", buf);
+    sprintf(buf, "%lld", (long long)file.mtime);
+    manifest.SetValue(section, "mtime", buf);
+
+    if (info.id.empty())
+        return;
+
+    manifest.SetValue(section, "id", info.id.c_str());
+    manifest.SetValue(section, "name", info.name.c_str());
+    manifest.SetLongValue(section, "abi", info.abi_version);
+    manifest.SetLongValue(section, "option-count", (long)options.size());
+
+    for (size_t i = 0, n = options.size(); i < n; ++i) {
+        const Option_Description &od = options[i];
+        std::string prefix = "option-" + std::to_string(i) + "-";
+        char type[2] = {od.type, '\0'};
+        manifest.SetValue(section, (prefix + "name").c_str(), od.name.c_str());
+        manifest.SetValue(section, (prefix + "description").c_str(), od.description.c_str());
+        manifest.SetValue(section, (prefix + "type").c_str(), type);
+        for (const std::string &value : od.initial)
+            manifest.SetValue(section, (prefix + "initial").c_str(), value.c_str());
+    }
+}
+
+auto Synth_Host::describe_plugin_options(const synth_interface &intf) -> std::vector<Option_Description>
+{
+    std::vector<Option_Description> options;
+
+    intf.plugin_init(get_configuration_dir().c_str());
+    auto plugin_cleanup = gsl::finally([&intf] { intf.plugin_shutdown(); });
+
+    const synth_option *opt;
+    for (size_t i = 0; (opt = intf.plugin_option(i)); ++i) {
+        Option_Description od;
+        od.name = opt->name;
+        od.description = opt->description;
+        od.type = opt->type;
+
+        char buf[64];
+        switch (opt->type) {
+        case 'i':
+            sprintf(buf, "%ld", opt->initial.i);
+            od.initial.emplace_back(buf);
+            break;
+        case 'f':
+            sprintf(buf, "%.17g", opt->initial.f);
+            od.initial.emplace_back(buf);
+            break;
+        case 'b':
+            od.initial.emplace_back(opt->initial.b ? "true" : "false");
+            break;
+        case 's':
+            od.initial.emplace_back(opt->initial.s);
+            break;
+        case 'm':
+            for (const char *const *p = opt->initial.m; *p; ++p)
+                od.initial.emplace_back(*p);
+            break;
+        default:
+            assert(false);
+        }
+
+        options.push_back(std::move(od));
+    }
+
+    return options;
+}
+
 std::string Synth_Host::plugin_path(const Plugin_Info &info)
 {
     std::string path;
@@ -262,107 +1160,94 @@ std::string Synth_Host::plugin_path(const Plugin_Info &info)
     return path;
 }
 
-void Synth_Host::initial_setup_plugin(const Plugin_Info &info, const synth_interface &intf)
+void Synth_Host::initial_setup_plugin(const Plugin_Info &info, const std::vector<Option_Description> &options)
 {
-    intf.plugin_init(get_configuration_dir().c_str());
-    auto plugin_cleanup = gsl::finally([&intf] { intf.plugin_shutdown(); });
-
-    size_t option_index = 0;
-    const synth_option *option = intf.plugin_option(option_index);
-
-    if (!option)
+    if (options.empty())
         return;
 
     std::unique_ptr<CSimpleIniA> ini = load_configuration("s_" + info.id);
     if (!ini) ini = create_configuration();
     bool ini_update = false;
 
-    do {
-        if (ini->GetValue("", option->name))
+    for (const Option_Description &od : options) {
+        const char *name = od.name.c_str();
+        if (ini->GetValue("", name))
             continue;
 
         ini_update = true;
-        std::string comment = "; " + std::string(option->description);
+        std::string comment = "; " + od.description;
 
-        switch (option->type) {
+        switch (od.type) {
         case 'i':
-            ini->SetLongValue("", option->name, option->initial.i, comment.c_str());
+            ini->SetLongValue("", name, strtol(od.initial[0].c_str(), nullptr, 10), comment.c_str());
             break;
         case 'f':
-            ini->SetDoubleValue("", option->name, option->initial.f, comment.c_str());
+            ini->SetDoubleValue("", name, strtod(od.initial[0].c_str(), nullptr), comment.c_str());
             break;
         case 'b':
-            ini->SetBoolValue("", option->name, option->initial.b, comment.c_str());
+            ini->SetBoolValue("", name, od.initial[0] == "true", comment.c_str());
             break;
         case 's':
-            ini->SetValue("", option->name, option->initial.s, comment.c_str());
+            ini->SetValue("", name, od.initial[0].c_str(), comment.c_str());
             break;
         case 'm':
-            for (const char *const *p0 = option->initial.m, *const *p = p0; *p; ++p)
-                ini->SetValue("", option->name, *p, (p == p0) ? comment.c_str() : nullptr);
+            for (size_t i = 0, n = od.initial.size(); i < n; ++i)
+                ini->SetValue("", name, od.initial[i].c_str(), (i == 0) ? comment.c_str() : nullptr);
             break;
         default:
             assert(false);
         }
-    } while ((option = intf.plugin_option(++option_index)));
+    }
 
     if (ini_update)
         save_configuration("s_" + info.id, *ini);
 }
 
-void Synth_Host::initial_setup_synth(const Plugin_Info &info, const synth_interface *intf, synth_object *synth)
+auto Synth_Host::load_synth_options(const Plugin_Info &info, const synth_interface *intf) -> std::vector<Option_Value>
 {
+    std::vector<Option_Value> values;
     std::unique_ptr<CSimpleIniA> ini = load_configuration("s_" + info.id);
 
-    if (!ini) {
-        const synth_option *opt;
-        for (size_t i = 0; (opt = intf->plugin_option(i)); ++i)
-            intf->synth_set_option(synth, opt->name, opt->initial);
-        return;
-    }
-
     const synth_option *opt;
     for (size_t i = 0; (opt = intf->plugin_option(i)); ++i) {
-        synth_value value = {};
-        bool valid = false;
+        values.emplace_back();
+        Option_Value &ov = values.back();
+        ov.option = opt;
 
-        std::unique_ptr<const char *[]> mval;
+        synth_value &value = ov.value;
+        bool valid = false;
 
         switch (opt->type) {
         case 'i':
-            if (const char *inival = ini->GetValue("", opt->name)) {
+            if (const char *inival = ini ? ini->GetValue("", opt->name) : nullptr) {
                 unsigned count = 0;
                 valid = sscanf(inival, "%ld%n", &value.i, &count) == 1 && count == strlen(inival);
             }
             break;
         case 'f':
-            if (const char *inival = ini->GetValue("", opt->name)) {
+            if (const char *inival = ini ? ini->GetValue("", opt->name) : nullptr) {
                 unsigned count = 0;
                 valid = sscanf(inival, "%lf%n", &value.f, &count) == 1 && count == strlen(inival);
             }
             break;
         case 'b':
-            if (const char *inival = ini->GetValue("", opt->name)) {
+            if (const char *inival = ini ? ini->GetValue("", opt->name) : nullptr) {
                 value.b = !strcmp(inival, "true");
                 valid = value.b || !strcmp(inival, "false");
             }
             break;
         case 's':
-            if (const char *inival = ini->GetValue("", opt->name)) {
-                value.s = inival;
+            if (const char *inival = ini ? ini->GetValue("", opt->name) : nullptr) {
+                ov.strings.emplace_back(inival);
                 valid = true;
             }
             break;
         case 'm': {
-            CSimpleIniA::TNamesDepend values;
-            if (ini->GetAllValues("", opt->name, values)) {
-                values.sort(CSimpleIniA::Entry::LoadOrder());
-                mval.reset(new const char *[values.size() + 1]);
-                const char **p = mval.get();
-                for (const CSimpleIniA::Entry &ent : values)
-                    *p++ = ent.pItem;
-                *p++ = nullptr;
-                value.m = mval.get();
+            CSimpleIniA::TNamesDepend inivals;
+            if (ini && ini->GetAllValues("", opt->name, inivals)) {
+                inivals.sort(CSimpleIniA::Entry::LoadOrder());
+                for (const CSimpleIniA::Entry &ent : inivals)
+                    ov.strings.emplace_back(ent.pItem);
                 valid = true;
             }
             break;
@@ -371,6 +1256,95 @@ void Synth_Host::initial_setup_synth(const Plugin_Info &info, const synth_interf
             assert(false);
         }
 
-        intf->synth_set_option(synth, opt->name, valid ? value : opt->initial);
+        if (!valid) {
+            value = opt->initial;
+            ov.strings.clear();
+            if (opt->type == 's')
+                ov.strings.emplace_back(opt->initial.s);
+            else if (opt->type == 'm') {
+                for (const char *const *p = opt->initial.m; *p; ++p)
+                    ov.strings.emplace_back(*p);
+            }
+        }
+    }
+
+    return values;
+}
+
+void Synth_Host::apply_synth_options(const synth_interface *intf, synth_object *synth, const std::vector<Option_Value> &values)
+{
+    for (const Option_Value &ov : values) {
+        const synth_option *opt = ov.option;
+        synth_value value = ov.value;
+
+        std::unique_ptr<const char *[]> mval;
+
+        switch (opt->type) {
+        case 's':
+            value.s = ov.strings[0].c_str();
+            break;
+        case 'm': {
+            mval.reset(new const char *[ov.strings.size() + 1]);
+            const char **p = mval.get();
+            for (const std::string &str : ov.strings)
+                *p++ = str.c_str();
+            *p++ = nullptr;
+            value.m = mval.get();
+            break;
+        }
+        }
+
+        intf->synth_set_option(synth, opt->name, value);
     }
 }
+
+std::string Synth_Host::make_instance_key(const Plugin_Info &info, double srate, const std::vector<Option_Value> &values)
+{
+    std::string text;
+    text.reserve(1024);
+
+    char buf[64];
+    for (const Option_Value &ov : values) {
+        const synth_option *opt = ov.option;
+        text.append(opt->name);
+        text.push_back('=');
+        switch (opt->type) {
+        case 'i':
+            sprintf(buf, "%ld", ov.value.i);
+            text.append(buf);
+            break;
+        case 'f':
+            sprintf(buf, "%.17g", ov.value.f);
+            text.append(buf);
+            break;
+        case 'b':
+            text.append(ov.value.b ? "true" : "false");
+            break;
+        case 's':
+        case 'm':
+            for (const std::string &str : ov.strings) {
+                text.append(str);
+                text.push_back('\0');
+            }
+            break;
+        }
+        text.push_back('\n');
+    }
+
+    // the options in full, two configurations never have the same key
+    sprintf(buf, "/%.17g/", srate);
+    return info.id + buf + text;
+}
+
+std::string Synth_Host::make_remote_key(const Plugin_Info &info, double srate)
+{
+    // the plugin is not loaded here, so it is the configuration as a whole
+    std::string text;
+    std::unique_ptr<CSimpleIniA> ini = load_configuration("s_" + info.id);
+    if (ini)
+        ini->Save(text);
+
+    char buf[64];
+    sprintf(buf, "@%.17g/", srate);
+    return info.id + buf + text;
+}
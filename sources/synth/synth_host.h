@@ -5,16 +5,23 @@
 
 #pragma once
 #include "synth.h"
+#include "synth_remote.h"
 #include "utility/load_library.h"
+#include "utility/worker_pool.h"
+#include "utility/charset.h"
+#include "audio/sinc_resampler.h"
 #include <SimpleIni.h>
 #include <gsl/gsl>
 #include <string>
 #include <vector>
+#include <list>
+#include <map>
 #include <memory>
 
 class Synth_Host {
 public:
-    Synth_Host();
+    // the child process of an isolated synth hosts the plugin itself
+    explicit Synth_Host(bool remote_child = false);
     ~Synth_Host();
 
 private:
@@ -27,6 +34,7 @@ public:
     struct Plugin_Info {
         std::string id;
         std::string name;
+        unsigned abi_version = 0;
     };
 
     static const std::string &plugin_dir();
@@ -34,16 +42,116 @@ public:
 
     bool load(gsl::cstring_span id, double srate);
     void unload();
+    void clear_cache();
     void generate(float *buffer, size_t nframes);
+    void generate_planar(float *left, float *right, size_t nframes);
     void send_midi(const uint8_t *data, unsigned len);
+    // whether the synth stays silent until the next message, as far as the
+    // plugin can tell; assumed if it cannot
+    bool is_idle() const;
     bool can_preload() const;
     void preload(gsl::span<const synth_midi_ins> instruments);
 
+private:
+    // an activated synth, which is either the current one or kept warm in cache
+    // in parallel mode, it is made of several synths which share the channels
+    struct Instance {
+        std::string key;
+        const synth_interface *intf = nullptr;
+        std::vector<synth_object *> parts;
+        uint8_t channel_part[16] = {};
+        double srate = 0;
+        // rate of the parts, which differs from srate if resampled
+        double render_rate = 0;
+        std::unique_ptr<Sinc_Resampler> resampler;
+        // block size of the parts, if the plugin has a preference
+        size_t block_size = 0;
+        bool block_fixed = false;
+        std::unique_ptr<float[]> block_buffer;
+        size_t block_frames = 0;
+        size_t memory_usage = 0;
+        // steps by which the governor has reduced the polyphony
+        unsigned polyphony_cut = 0;
+    };
+
+    enum Partition_Policy {
+        Partition_Interleaved,
+        Partition_Contiguous,
+        Partition_Percussion,
+    };
+
+    struct Option_Value {
+        const synth_option *option = nullptr;
+        synth_value value {};
+        std::vector<std::string> strings;
+    };
+
+    // the option of a plugin, as it is recorded in the manifest
+    struct Option_Description {
+        std::string name;
+        std::string description;
+        char type = 0;
+        std::vector<std::string> initial;
+    };
+
+    void acquire_plugin(const synth_interface *intf);
+    void release_plugin(const synth_interface *intf);
+    bool create_instance(const synth_interface *intf, double srate, const std::vector<Option_Value> &options, Instance &inst);
+    void destroy_instance(Instance &inst);
+    void trim_cache(size_t budget);
+    void assign_channels(unsigned nparts, uint8_t channel_part[16]) const;
+    bool load_remote(gsl::cstring_span id, double srate);
+    void generate_remote(float *buffer, size_t nframes);
+    void generate_current(float *buffer, size_t nframes);
+    void generate_resampled(float *buffer, size_t nframes);
+    void generate_native(float *buffer, size_t nframes);
+    void generate_parts(float *buffer, size_t nframes);
+    void generate_parallel(float *buffer, size_t nframes);
+    static void generate_part(void *user_data, size_t index);
+    void govern_polyphony(double busy_time, double period_time);
+    static void cut_polyphony(Instance &inst, unsigned cut);
+
 private:
     Dl_Handle module_;
     std::map<std::string, Dl_Handle_U> loaded_modules_;
-    const synth_interface *intf_ = nullptr;
-    synth_object *synth_ = nullptr;
+    std::map<const synth_interface *, unsigned> plugin_users_;
+    Instance current_;
+
+    // most recently used first
+    std::list<Instance> cache_;
+    size_t cache_budget_ = 0;
+
+    // parallel rendering
+    unsigned parallel_instances_ = 1;
+    Partition_Policy partition_policy_ = Partition_Interleaved;
+    std::unique_ptr<Worker_Pool> worker_pool_;
+    std::unique_ptr<float[]> part_buffer_;
+    size_t part_frames_ = 0;
+    unsigned deadline_misses_ = 0;
+    unsigned serial_slices_ = 0;
+    unsigned long total_deadline_misses_ = 0;
+
+    // reduction of the polyphony under a sustained load
+    bool polyphony_governor_ = true;
+    double governor_busy_time_ = 0;
+    double governor_period_time_ = 0;
+    unsigned governor_over_windows_ = 0;
+    unsigned governor_under_windows_ = 0;
+    unsigned long total_polyphony_cuts_ = 0;
+
+    // rendering at the native rate of the plugin
+    bool native_rate_ = true;
+    std::unique_ptr<float[]> resample_buffer_;
+
+    // rendering into separate channels, if the plugin cannot do it itself
+    std::unique_ptr<float[]> planar_buffer_;
+
+    // isolation of the plugins in child processes, one per parallel instance
+    bool isolation_ = false;
+    std::string remote_key_;
+    std::vector<std::unique_ptr<Synth_Remote>> remotes_;
+    uint8_t remote_channel_[16] = {};
+    std::unique_ptr<float[]> remote_buffer_;
 
 private:
     static std::string plugin_path(const Plugin_Info &info);
@@ -51,6 +159,13 @@ private:
 private:
     static std::string find_plugin_dir();
     static std::vector<Plugin_Info> do_plugin_scan();
-    static void initial_setup_plugin(const Plugin_Info &info, const synth_interface &intf);
-    static void initial_setup_synth(const Plugin_Info &info, const synth_interface *intf, synth_object *synth);
+    static bool scan_plugin_file(const std::string &path, gsl::cstring_span id, Plugin_Info &info, std::vector<Option_Description> &options);
+    static bool read_manifest_entry(const CSimpleIniA &manifest, const std::string &path, const File_Info &file, Plugin_Info &info, std::vector<Option_Description> &options);
+    static void write_manifest_entry(CSimpleIniA &manifest, const std::string &path, const File_Info &file, const Plugin_Info &info, const std::vector<Option_Description> &options);
+    static std::vector<Option_Description> describe_plugin_options(const synth_interface &intf);
+    static void initial_setup_plugin(const Plugin_Info &info, const std::vector<Option_Description> &options);
+    static std::vector<Option_Value> load_synth_options(const Plugin_Info &info, const synth_interface *intf);
+    static void apply_synth_options(const synth_interface *intf, synth_object *synth, const std::vector<Option_Value> &values);
+    static std::string make_instance_key(const Plugin_Info &info, double srate, const std::vector<Option_Value> &values);
+    static std::string make_remote_key(const Plugin_Info &info, double srate);
 };
@@ -0,0 +1,808 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_remote.h"
+#include "synth_host.h"
+#include "player/smfutil.h"
+#include "utility/module.h"
+#include "utility/realtime.h"
+#include "utility/logs.h"
+#include <algorithm>
+#include <initializer_list>
+#include <chrono>
+#include <new>
+#include <cstring>
+#include <cstdio>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <semaphore.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>
+#include <cerrno>
+extern char **environ;
+#endif
+
+const char Synth_Remote::child_argument[] = "--synth-child";
+
+#if defined(__linux__)
+
+// size of the ring of MIDI messages, a power of 2
+static constexpr size_t remote_midi_ring_size = 16384;
+// maximum number of instruments in a request of preload
+static constexpr size_t remote_preload_max = 2048;
+// descriptor of the shared memory, in the child process
+static constexpr int remote_child_fd = 3;
+
+// time the child has to load the synth, or to preload instruments (s)
+static constexpr double remote_load_timeout = 10;
+static constexpr double remote_preload_timeout = 30;
+// time the child has to finish a block, for a command which waits for it (s)
+static constexpr double remote_block_timeout = 50e-3;
+// least time to receive a block, which is otherwise its duration (s)
+static constexpr double remote_receive_min = 1e-3;
+// interval of the watchdog, and its checks before a late child is restarted
+static constexpr unsigned remote_watchdog_interval = 100;
+static constexpr unsigned remote_hang_checks = 10;
+// consecutive restarts which fail, before the watchdog gives up
+static constexpr unsigned remote_restart_max = 3;
+// size of the system exclusive messages kept for a restart
+static constexpr size_t remote_sysex_log_size = 2048;
+// the value of the channel state which no message has set
+static constexpr uint8_t remote_unset = 0xff;
+
+enum Remote_Command : uint32_t {
+    Remote_Load,
+    Remote_Generate,
+    Remote_Preload,
+    Remote_Quit,
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "atomics must be lock-free, to be shared between processes");
+
+struct Synth_Remote_Shared {
+    sem_t request;
+    sem_t reply;
+
+    // the command, and the arguments of it
+    uint32_t command;
+    int32_t status;
+    uint32_t nframes;
+    double srate;
+    char id[256];
+    uint32_t preload_count;
+    synth_midi_ins preload[remote_preload_max];
+
+    // whether the synth is idle after the last block
+    std::atomic<uint32_t> idle;
+
+    // messages as a 2-byte length and the data, written by the host only
+    std::atomic<uint32_t> midi_write;
+    std::atomic<uint32_t> midi_read;
+    uint8_t midi_ring[remote_midi_ring_size];
+
+    float audio[2 * Synth_Remote::frames_max];
+};
+
+static timespec timespec_after(clockid_t clock, std::chrono::nanoseconds delay)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    long long nsec = ts.tv_nsec + std::max<long long>(0, delay.count());
+    ts.tv_sec += (time_t)(nsec / 1000000000);
+    ts.tv_nsec = (long)(nsec % 1000000000);
+    return ts;
+}
+
+// the deadline is of the monotonic clock, which a change of the date does not move
+static bool sem_wait_until(sem_t *sem, std::chrono::steady_clock::time_point deadline)
+{
+    std::chrono::nanoseconds delay = deadline - std::chrono::steady_clock::now();
+
+    int ret;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    timespec ts = timespec_after(CLOCK_MONOTONIC, delay);
+    while ((ret = sem_clockwait(sem, CLOCK_MONOTONIC, &ts)) == -1 && errno == EINTR);
+#else
+    timespec ts = timespec_after(CLOCK_REALTIME, delay);
+    while ((ret = sem_timedwait(sem, &ts)) == -1 && errno == EINTR);
+#endif
+    return ret == 0;
+}
+
+static bool sem_wait_for(sem_t *sem, double timeout)
+{
+    std::chrono::duration<double> delay(timeout);
+    return sem_wait_until(sem, std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+}
+
+Synth_Remote::Synth_Remote()
+{
+    sysex_log_.reserve(remote_sysex_log_size);
+    clear_tracked();
+}
+
+Synth_Remote::~Synth_Remote()
+{
+    stop();
+}
+
+bool Synth_Remote::is_supported()
+{
+    return true;
+}
+
+bool Synth_Remote::start(gsl::cstring_span id, double srate)
+{
+    stop();
+
+    id_ = gsl::to_string(id);
+    srate_ = srate;
+
+    if (id_.size() >= sizeof(Synth_Remote_Shared::id) || !create_shared())
+        return false;
+
+    reset_shared();
+    failed_restarts_ = 0;
+    watchdog_quit_ = false;
+    watchdog_started_ = false;
+    watchdog_ = std::thread([this] { watchdog_exec(); });
+
+    std::unique_lock<std::mutex> lock(watchdog_mutex_);
+    watchdog_cond_.wait(lock, [this] { return watchdog_started_; });
+    bool started = child_started_;
+    lock.unlock();
+
+    if (!started) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Synth_Remote::stop()
+{
+    // the watchdog quits the child, before it ends
+    if (watchdog_.joinable()) {
+        std::unique_lock<std::mutex> lock(watchdog_mutex_);
+        watchdog_quit_ = true;
+        watchdog_cond_.notify_all();
+        lock.unlock();
+        watchdog_.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_.store(false);
+    wait_sends();
+
+    if (dropped_messages_ > 0) {
+        Log::w("Synth child dropped %lu messages", dropped_messages_);
+        dropped_messages_ = 0;
+    }
+
+    if (shared_) {
+        sem_destroy(&shared_->request);
+        sem_destroy(&shared_->reply);
+        munmap(shared_, sizeof(Synth_Remote_Shared));
+        shared_ = nullptr;
+    }
+    if (shared_fd_ != -1) {
+        close(shared_fd_);
+        shared_fd_ = -1;
+    }
+
+    busy_ = false;
+    stalled_.store(false);
+    preloaded_.clear();
+    clear_tracked();
+}
+
+bool Synth_Remote::create_shared()
+{
+    int fd = memfd_create("smf-dsp-synth", MFD_CLOEXEC);
+    if (fd == -1)
+        return false;
+    shared_fd_ = fd;
+
+    if (ftruncate(fd, sizeof(Synth_Remote_Shared)) == -1)
+        return false;
+
+    void *addr = mmap(nullptr, sizeof(Synth_Remote_Shared), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return false;
+
+    shared_ = new (addr) Synth_Remote_Shared;
+    sem_init(&shared_->request, 1, 0);
+    sem_init(&shared_->reply, 1, 0);
+    return true;
+}
+
+void Synth_Remote::reset_shared()
+{
+    // no process waits on these, after the child is gone
+    sem_destroy(&shared_->request);
+    sem_destroy(&shared_->reply);
+    sem_init(&shared_->request, 1, 0);
+    sem_init(&shared_->reply, 1, 0);
+
+    shared_->idle.store(1);
+    shared_->midi_write.store(0);
+    shared_->midi_read.store(0);
+
+    busy_ = false;
+    stalled_.store(false);
+}
+
+bool Synth_Remote::spawn_child()
+{
+    std::string exe = get_executable_path();
+    if (exe.empty())
+        return false;
+
+    char fd_argument[16];
+    sprintf(fd_argument, "%d", remote_child_fd);
+    char *argv[] = {(char *)exe.c_str(), (char *)child_argument, fd_argument, nullptr};
+
+    // the duplicate at the fixed descriptor is inherited, the original is not
+    int fd = shared_fd_;
+    if (fd == remote_child_fd) {
+        fd = fcntl(shared_fd_, F_DUPFD_CLOEXEC, remote_child_fd + 1);
+        if (fd == -1)
+            return false;
+    }
+    auto fd_cleanup = gsl::finally([this, fd] { if (fd != shared_fd_) close(fd); });
+
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return false;
+    auto actions_cleanup = gsl::finally([&actions] { posix_spawn_file_actions_destroy(&actions); });
+    posix_spawn_file_actions_adddup2(&actions, fd, remote_child_fd);
+
+    pid_t pid;
+    if (posix_spawn(&pid, exe.c_str(), &actions, nullptr, argv, environ) != 0) {
+        Log::e("Cannot start the synth child process");
+        return false;
+    }
+
+    Log::i("Start synth child process %d: %s", (int)pid, id_.c_str());
+    pid_ = (int)pid;
+    return true;
+}
+
+void Synth_Remote::kill_child()
+{
+    if (pid_ == -1)
+        return;
+
+    // a moment to quit by itself, then the hard way
+    for (unsigned i = 0; i < 10; ++i) {
+        if (waitpid(pid_, nullptr, WNOHANG) == pid_) {
+            pid_ = -1;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    kill(pid_, SIGKILL);
+    waitpid(pid_, nullptr, 0);
+    pid_ = -1;
+}
+
+bool Synth_Remote::load_child()
+{
+    Synth_Remote_Shared &shared = *shared_;
+    shared.command = Remote_Load;
+    shared.srate = srate_;
+    std::memcpy(shared.id, id_.c_str(), id_.size() + 1);
+    sem_post(&shared.request);
+
+    if (!wait_reply(remote_load_timeout)) {
+        Log::e("Synth child process does not respond to loading");
+        kill_child();
+        return false;
+    }
+    if (shared.status != 0) {
+        Log::e("Synth child process cannot load: %s", id_.c_str());
+        kill_child();
+        return false;
+    }
+    return true;
+}
+
+void Synth_Remote::quit_child()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_.store(false);
+    wait_sends();
+
+    if (pid_ == -1)
+        return;
+
+    // the child quits by itself, unless it does not respond
+    if (!busy_ || wait_reply(remote_block_timeout)) {
+        shared_->command = Remote_Quit;
+        sem_post(&shared_->request);
+        wait_reply(remote_block_timeout);
+    }
+    kill_child();
+}
+
+void Synth_Remote::preload_child()
+{
+    Synth_Remote_Shared &shared = *shared_;
+    size_t count = std::min(preloaded_.size(), remote_preload_max);
+    shared.command = Remote_Preload;
+    shared.preload_count = (uint32_t)count;
+    std::copy(preloaded_.begin(), preloaded_.begin() + count, shared.preload);
+    sem_post(&shared.request);
+
+    if (!wait_reply(remote_preload_timeout)) {
+        // the watchdog takes it from here
+        busy_ = true;
+        stalled_.store(true);
+    }
+}
+
+bool Synth_Remote::wait_reply(double timeout)
+{
+    return sem_wait_for(&shared_->reply, timeout);
+}
+
+void Synth_Remote::wait_sends()
+{
+    // the audio thread sees the child is not running, at the latest after
+    // the send which it has started
+    while (sending_.load())
+        std::this_thread::yield();
+}
+
+void Synth_Remote::send_midi(const uint8_t *data, unsigned len)
+{
+    sending_.store(true);
+    auto sent = gsl::finally([this] { sending_.store(false); });
+
+    // the ring is reset while the child does not run
+    if (!running_.load() || !shared_ || len == 0 || len > 0xffff)
+        return;
+
+    if (!write_midi(data, len)) {
+        ++dropped_messages_;
+        return;
+    }
+    track_midi(data, len);
+}
+
+// by the audio thread, or by the watchdog while the child does not run
+bool Synth_Remote::write_midi(const uint8_t *data, unsigned len)
+{
+    Synth_Remote_Shared *shared = shared_;
+    uint32_t write = shared->midi_write.load(std::memory_order_relaxed);
+    uint32_t read = shared->midi_read.load(std::memory_order_acquire);
+    if (remote_midi_ring_size - (write - read) < len + 2)
+        return false;
+
+    const size_t mask = remote_midi_ring_size - 1;
+    shared->midi_ring[write++ & mask] = (uint8_t)(len & 0xff);
+    shared->midi_ring[write++ & mask] = (uint8_t)(len >> 8);
+    for (unsigned i = 0; i < len; ++i)
+        shared->midi_ring[write++ & mask] = data[i];
+
+    shared->midi_write.store(write, std::memory_order_release);
+    return true;
+}
+
+void Synth_Remote::track_midi(const uint8_t *data, unsigned len)
+{
+    std::vector<uint8_t> &log = sysex_log_;
+
+    if (is_midi_reset_message(data, len))
+        clear_tracked();
+
+    if (data[0] >= 0xf0) {
+        // kept if there is room, without allocation
+        if (data[0] == 0xf0 || data[0] == 0xff) {
+            if (log.size() + len + 2 <= log.capacity()) {
+                log.push_back((uint8_t)(len & 0xff));
+                log.push_back((uint8_t)(len >> 8));
+                log.insert(log.end(), data, data + len);
+            }
+        }
+        return;
+    }
+
+    if (len < 2)
+        return;
+
+    Channel_State &ch = channels_[data[0] & 0x0f];
+    switch (data[0] & 0xf0) {
+    case 0xb0: {
+        if (len < 3)
+            break;
+        unsigned cc = data[1];
+        unsigned rpn = (ch.controllers[101] == 0) ? ch.controllers[100] : remote_unset;
+        switch (cc) {
+        case 6: case 38:
+            if (rpn < 3)
+                ch.rpn[rpn][cc == 38] = data[2];
+            break;
+        case 98: case 99:
+            // the data entry is for a NRPN, which is not kept
+            ch.controllers[100] = ch.controllers[101] = remote_unset;
+            break;
+        case 121:
+            // all but the bank, volume, pan and effect sends
+            for (unsigned i = 0; i < 120; ++i) {
+                if (i != 0 && i != 32 && i != 7 && i != 10 && i != 91 && i != 93)
+                    ch.controllers[i] = remote_unset;
+            }
+            ch.pressure = remote_unset;
+            ch.bend[0] = ch.bend[1] = remote_unset;
+            break;
+        default:
+            if (cc < 120)
+                ch.controllers[cc] = data[2];
+            break;
+        }
+        break;
+    }
+    case 0xc0:
+        ch.program = data[1];
+        break;
+    case 0xd0:
+        ch.pressure = data[1];
+        break;
+    case 0xe0:
+        if (len >= 3) {
+            ch.bend[0] = data[1];
+            ch.bend[1] = data[2];
+        }
+        break;
+    }
+}
+
+void Synth_Remote::clear_tracked()
+{
+    std::memset(channels_, remote_unset, sizeof(channels_));
+    sysex_log_.clear();
+}
+
+// the messages which put a new child in the state of the old one
+void Synth_Remote::replay_tracked()
+{
+    unsigned long lost = 0;
+    auto send = [this, &lost](std::initializer_list<uint8_t> msg) {
+        if (!write_midi(msg.begin(), (unsigned)msg.size()))
+            ++lost;
+    };
+
+    const std::vector<uint8_t> &log = sysex_log_;
+    for (size_t i = 0; i + 2 <= log.size();) {
+        unsigned len = log[i] | (log[i + 1] << 8);
+        if (!write_midi(&log[i + 2], len))
+            ++lost;
+        i += 2 + len;
+    }
+
+    for (unsigned c = 0; c < 16; ++c) {
+        const Channel_State &ch = channels_[c];
+        const uint8_t cc = (uint8_t)(0xb0 | c);
+
+        // the bank, before the program which it selects
+        for (uint8_t i : {0, 32}) {
+            if (ch.controllers[i] != remote_unset)
+                send({cc, i, ch.controllers[i]});
+        }
+        if (ch.program != remote_unset)
+            send({(uint8_t)(0xc0 | c), ch.program});
+
+        for (uint8_t i = 1; i < 120; ++i) {
+            bool skip = i == 32 || i == 6 || i == 38 || i == 100 || i == 101;
+            if (!skip && ch.controllers[i] != remote_unset)
+                send({cc, i, ch.controllers[i]});
+        }
+
+        for (uint8_t r = 0; r < 3; ++r) {
+            if (ch.rpn[r][0] == remote_unset && ch.rpn[r][1] == remote_unset)
+                continue;
+            send({cc, 101, 0});
+            send({cc, 100, r});
+            if (ch.rpn[r][0] != remote_unset)
+                send({cc, 6, ch.rpn[r][0]});
+            if (ch.rpn[r][1] != remote_unset)
+                send({cc, 38, ch.rpn[r][1]});
+        }
+        // the parameter which the data entry selects
+        send({cc, 101, (ch.controllers[101] != remote_unset) ? ch.controllers[101] : (uint8_t)127});
+        send({cc, 100, (ch.controllers[100] != remote_unset) ? ch.controllers[100] : (uint8_t)127});
+
+        if (ch.pressure != remote_unset)
+            send({(uint8_t)(0xd0 | c), ch.pressure});
+        if (ch.bend[0] != remote_unset)
+            send({(uint8_t)(0xe0 | c), ch.bend[0], ch.bend[1]});
+    }
+
+    if (lost > 0)
+        Log::w("Synth child process lost %lu messages of the channel state", lost);
+}
+
+void Synth_Remote::request(size_t nframes)
+{
+    requested_ = false;
+
+    audio_lock_ = std::unique_lock<std::mutex>(mutex_, std::try_to_lock);
+    if (!audio_lock_.owns_lock() || !running_.load())
+        return;
+
+    if (busy_) {
+        // the reply of an earlier block, which came late and is dropped
+        if (sem_trywait(&shared_->reply) != 0)
+            return;
+        busy_ = false;
+    }
+
+    shared_->command = Remote_Generate;
+    shared_->nframes = (uint32_t)nframes;
+    sem_post(&shared_->request);
+    busy_ = true;
+    requested_ = true;
+
+    // the children render at the same time, so the receptions share a
+    // deadline, which is the duration of the block
+    double duration = std::max(remote_receive_min, nframes / srate_);
+    reply_deadline_ = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration));
+}
+
+bool Synth_Remote::receive(float *buffer, size_t nframes)
+{
+    auto unlock = gsl::finally([this] { if (audio_lock_.owns_lock()) audio_lock_.unlock(); });
+
+    if (requested_) {
+        if (sem_wait_until(&shared_->reply, reply_deadline_)) {
+            busy_ = false;
+            stalled_.store(false);
+            std::copy(shared_->audio, shared_->audio + 2 * nframes, buffer);
+            return true;
+        }
+        stalled_.store(true);
+    }
+
+    std::fill(buffer, buffer + 2 * nframes, 0);
+    return false;
+}
+
+bool Synth_Remote::is_idle() const
+{
+    const Synth_Remote_Shared *shared = shared_;
+    return !running_.load() || !shared || shared->idle.load(std::memory_order_relaxed);
+}
+
+void Synth_Remote::preload(gsl::span<const synth_midi_ins> instruments)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // kept, to be sent again to a child which restarts
+    preloaded_.assign(instruments.begin(), instruments.end());
+
+    if (!running_.load())
+        return;
+    if (busy_ && !wait_reply(remote_block_timeout))
+        return;
+    busy_ = false;
+
+    preload_child();
+}
+
+void Synth_Remote::restart()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_.store(false);
+    wait_sends();
+
+    if (pid_ != -1) {
+        kill(pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+        pid_ = -1;
+    }
+
+    if (failed_restarts_ >= remote_restart_max)
+        return;
+
+    reset_shared();
+    if (!spawn_child() || !load_child()) {
+        if (++failed_restarts_ == remote_restart_max)
+            Log::e("Synth child process fails to restart, give up");
+        return;
+    }
+
+    failed_restarts_ = 0;
+    if (!preloaded_.empty())
+        preload_child();
+    // the audio thread does not send, until the child runs
+    replay_tracked();
+    running_.store(true);
+}
+
+void Synth_Remote::watchdog_exec()
+{
+    // the children are spawned by this thread, because the signal of the
+    // death of the parent comes at the end of the thread which spawns
+    bool started;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        started = spawn_child() && load_child();
+        running_.store(started);
+    }
+
+    std::unique_lock<std::mutex> lock(watchdog_mutex_);
+    watchdog_started_ = true;
+    child_started_ = started;
+    watchdog_cond_.notify_all();
+    if (!started)
+        return;
+
+    unsigned hang_checks = 0;
+    while (!watchdog_quit_) {
+        watchdog_cond_.wait_for(lock, std::chrono::milliseconds(remote_watchdog_interval));
+        if (watchdog_quit_)
+            break;
+
+        // only this thread changes the child, while the watchdog runs
+        int status = 0;
+        bool exited = pid_ == -1 || waitpid(pid_, &status, WNOHANG) == pid_;
+        if (exited && pid_ != -1) {
+            Log::w("Synth child process %d has exited (status %d)", pid_, status);
+            pid_ = -1;
+        }
+
+        hang_checks = stalled_.load() ? (hang_checks + 1) : 0;
+        bool hung = hang_checks >= remote_hang_checks;
+        if (hung)
+            Log::w("Synth child process %d does not respond", pid_);
+
+        if (exited || hung) {
+            lock.unlock();
+            restart();
+            lock.lock();
+            hang_checks = 0;
+        }
+    }
+
+    lock.unlock();
+    quit_child();
+}
+
+int Synth_Remote::child_main(int fd)
+{
+    // the child does not outlive the watchdog of the player
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    void *addr = mmap(nullptr, sizeof(Synth_Remote_Shared), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return 1;
+    close(fd);
+    Synth_Remote_Shared &shared = *(Synth_Remote_Shared *)addr;
+
+    realtime_initialize();
+    realtime_setup_thread(Realtime_Thread_Render);
+    disable_denormals();
+
+    Synth_Host host(true);
+    const size_t mask = remote_midi_ring_size - 1;
+    uint8_t message[0xffff];
+
+    auto receive_midi = [&shared, &host, mask, &message]() {
+        uint32_t read = shared.midi_read.load(std::memory_order_relaxed);
+        uint32_t write = shared.midi_write.load(std::memory_order_acquire);
+        // the host is not trusted with the lengths, the rest is dropped if
+        // one does not fit in what is written
+        if (write - read > remote_midi_ring_size)
+            read = write;
+        while (read != write) {
+            if (write - read < 2) {
+                read = write;
+                break;
+            }
+            unsigned len = shared.midi_ring[read++ & mask];
+            len |= shared.midi_ring[read++ & mask] << 8;
+            if (len > write - read) {
+                read = write;
+                break;
+            }
+            for (unsigned i = 0; i < len; ++i)
+                message[i] = shared.midi_ring[read++ & mask];
+            host.send_midi(message, len);
+        }
+        shared.midi_read.store(read, std::memory_order_release);
+    };
+
+    for (;;) {
+        while (sem_wait(&shared.request) == -1 && errno == EINTR);
+
+        switch (shared.command) {
+        case Remote_Load:
+            shared.id[sizeof(shared.id) - 1] = '\0';
+            shared.status = host.load(shared.id, shared.srate) ? 0 : -1;
+            break;
+        case Remote_Generate:
+            receive_midi();
+            host.generate(shared.audio, std::min<size_t>(shared.nframes, frames_max));
+            shared.idle.store(host.is_idle(), std::memory_order_relaxed);
+            break;
+        case Remote_Preload:
+            if (host.can_preload())
+                host.preload(gsl::span<const synth_midi_ins>(
+                    shared.preload, std::min<size_t>(shared.preload_count, remote_preload_max)));
+            break;
+        case Remote_Quit:
+            host.unload();
+            sem_post(&shared.reply);
+            return 0;
+        }
+
+        sem_post(&shared.reply);
+    }
+}
+
+#else
+
+struct Synth_Remote_Shared {};
+
+Synth_Remote::Synth_Remote()
+{
+}
+
+Synth_Remote::~Synth_Remote()
+{
+}
+
+bool Synth_Remote::is_supported()
+{
+    return false;
+}
+
+bool Synth_Remote::start(gsl::cstring_span, double)
+{
+    return false;
+}
+
+void Synth_Remote::stop()
+{
+}
+
+void Synth_Remote::send_midi(const uint8_t *, unsigned)
+{
+}
+
+void Synth_Remote::request(size_t)
+{
+}
+
+bool Synth_Remote::receive(float *buffer, size_t nframes)
+{
+    std::fill(buffer, buffer + 2 * nframes, 0);
+    return false;
+}
+
+bool Synth_Remote::is_idle() const
+{
+    return true;
+}
+
+void Synth_Remote::preload(gsl::span<const synth_midi_ins>)
+{
+}
+
+int Synth_Remote::child_main(int)
+{
+    return 1;
+}
+
+#endif
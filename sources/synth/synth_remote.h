@@ -0,0 +1,116 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "synth.h"
+#include <gsl/gsl>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct Synth_Remote_Shared;
+
+// A synth which runs in a child process, so that a plugin which hangs or
+// crashes does not take the player down with it. The child is driven through
+// shared memory, which carries the MIDI messages in a lock-free ring and the
+// audio of the current block. A watchdog restarts the child if it exits, or
+// if it stops responding, and sends it again the state of the channels.
+class Synth_Remote {
+public:
+    Synth_Remote();
+    ~Synth_Remote();
+
+private:
+    Synth_Remote(const Synth_Remote &) = delete;
+    Synth_Remote &operator=(const Synth_Remote &) = delete;
+
+public:
+    static bool is_supported();
+
+    bool start(gsl::cstring_span id, double srate);
+    void stop();
+
+    // from the audio thread: the messages, then the request of a block and
+    // the reception of it, which lets several children render at once
+    void send_midi(const uint8_t *data, unsigned len);
+    void request(size_t nframes);
+    bool receive(float *buffer, size_t nframes); // false if zero-filled
+    bool is_idle() const;
+
+    // from another thread, it waits until the child has finished
+    void preload(gsl::span<const synth_midi_ins> instruments);
+
+    static constexpr size_t frames_max = 512;
+
+    // the command line of the child process
+    static const char child_argument[];
+    static int child_main(int fd);
+
+private:
+    bool create_shared();
+    void reset_shared();
+    bool spawn_child();
+    void kill_child();
+    bool load_child();
+    void quit_child();
+    void preload_child();
+    bool write_midi(const uint8_t *data, unsigned len);
+    void track_midi(const uint8_t *data, unsigned len);
+    void clear_tracked();
+    void replay_tracked();
+    bool wait_reply(double timeout);
+    void wait_sends();
+    void restart();
+    void watchdog_exec();
+
+private:
+    std::string id_;
+    double srate_ = 0;
+    int shared_fd_ = -1;
+    Synth_Remote_Shared *shared_ = nullptr;
+    int pid_ = -1;
+
+    // held by the audio thread from a request to the reception, and by the
+    // other threads for a restart or a long command
+    std::mutex mutex_;
+    std::unique_lock<std::mutex> audio_lock_;
+    bool requested_ = false;
+    // a block was requested, and its reply is not received yet
+    bool busy_ = false;
+    std::chrono::steady_clock::time_point reply_deadline_;
+    std::atomic<bool> running_{false};
+    // the audio thread writes in the ring of messages
+    std::atomic<bool> sending_{false};
+    std::atomic<bool> stalled_{false};
+    std::vector<synth_midi_ins> preloaded_;
+    unsigned long dropped_messages_ = 0;
+
+    // the state which the messages have set, since the last reset, written
+    // by the audio thread as it sends, and read for a restart
+    struct Channel_State {
+        uint8_t controllers[128];
+        uint8_t program;
+        uint8_t pressure;
+        uint8_t bend[2];
+        uint8_t rpn[3][2]; // bend range, fine and coarse tuning
+    };
+    Channel_State channels_[16];
+    // the system exclusive messages, each after its 2-byte length
+    std::vector<uint8_t> sysex_log_;
+
+    // the thread which spawns the children, which do not outlive it
+    std::thread watchdog_;
+    std::mutex watchdog_mutex_;
+    std::condition_variable watchdog_cond_;
+    bool watchdog_quit_ = false;
+    bool watchdog_started_ = false;
+    bool child_started_ = false;
+    unsigned failed_restarts_ = 0;
+};
@@ -195,6 +195,28 @@ int filemode_utf8(const char *path)
     return st.st_mode;
 }
 
+bool fileinfo_utf8(const char *path, File_Info &info)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+#else
+    struct _stat st;
+    std::wstring wpath;
+    if (!convert_utf<char, wchar_t>(path, wpath, false)) {
+        errno = EINVAL;
+        return false;
+    }
+    if (_wstat(wpath.c_str(), &st) != 0)
+        return false;
+#endif
+    info.mode = st.st_mode;
+    info.size = (uint64_t)st.st_size;
+    info.mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
 bool make_directory(gsl::cstring_span path)
 {
 #ifndef _WIN32
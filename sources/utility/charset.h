@@ -24,6 +24,13 @@ int utf8_strcoll(gsl::cstring_span a, gsl::cstring_span b);
 FILE *fopen_utf8(const char *path, const char *mode);
 int filemode_utf8(const char *path);
 
+struct File_Info {
+    int mode = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+bool fileinfo_utf8(const char *path, File_Info &info);
+
 // directories
 bool make_directory(gsl::cstring_span path);
 
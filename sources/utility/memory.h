@@ -0,0 +1,10 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <cstddef>
+
+// the resident memory of the process, or 0 if it is unknown
+size_t get_resident_memory();
@@ -0,0 +1,236 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "realtime.h"
+#include "configuration.h"
+#include "utility/logs.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define HAVE_SSE_CSR 1
+#endif
+
+// size of stack touched by each real-time thread, to take the page faults early
+static constexpr size_t stack_prefault_size = 64 * 1024;
+
+static bool realtime_enabled = false;
+static int realtime_priority = 0;
+static bool memory_locked = false;
+static bool memory_locked_future = false;
+
+#if defined(HAVE_SSE_CSR)
+static constexpr unsigned csr_flush_to_zero = 0x8000;
+static constexpr unsigned csr_denormals_are_zero = 0x0040;
+#elif defined(__aarch64__)
+static constexpr unsigned long fpcr_flush_to_zero = 1ul << 24;
+#endif
+
+static unsigned long get_fp_control() noexcept
+{
+#if defined(HAVE_SSE_CSR)
+    return _mm_getcsr();
+#elif defined(__aarch64__)
+    unsigned long fpcr;
+    __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+    return fpcr;
+#else
+    return 0;
+#endif
+}
+
+static void set_fp_control(unsigned long value) noexcept
+{
+#if defined(HAVE_SSE_CSR)
+    _mm_setcsr((unsigned)value);
+#elif defined(__aarch64__)
+    __asm__ volatile("msr fpcr, %0" : : "r"(value));
+#else
+    (void)value;
+#endif
+}
+
+static unsigned long with_denormals_disabled(unsigned long value) noexcept
+{
+#if defined(HAVE_SSE_CSR)
+    return value | csr_flush_to_zero | csr_denormals_are_zero;
+#elif defined(__aarch64__)
+    return value | fpcr_flush_to_zero;
+#else
+    return value;
+#endif
+}
+
+static bool can_disable_denormals()
+{
+#if defined(HAVE_SSE_CSR) || defined(__aarch64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if !defined(_WIN32)
+static bool lock_process_memory()
+{
+    // only lock future allocations if unlimited, otherwise they could fail
+    struct rlimit lim;
+    bool unlimited = getrlimit(RLIMIT_MEMLOCK, &lim) == 0 && lim.rlim_cur == RLIM_INFINITY;
+
+    int flags = MCL_CURRENT | (unlimited ? MCL_FUTURE : 0);
+    if (mlockall(flags) != 0) {
+        Log::w("Cannot lock memory: %s", strerror(errno));
+        return false;
+    }
+
+    Log::i("Memory locked: %s", unlimited ? "current and future" : "current");
+    memory_locked_future = unlimited;
+    return true;
+}
+#endif
+
+void realtime_initialize()
+{
+    static bool initialized = false;
+    if (initialized)
+        return;
+    initialized = true;
+
+    std::unique_ptr<CSimpleIniA> ini = load_global_configuration();
+    if (!ini)
+        ini = create_configuration();
+
+    realtime_enabled = ini->GetBoolValue("", "realtime-profile", false);
+    long priority = ini->GetLongValue("", "realtime-priority", 60);
+    realtime_priority = (int)std::max(1L, std::min(99L, priority));
+
+    // self-check, reports what the system permits
+    Log::i("Denormal flushing: %s", can_disable_denormals() ? "available" : "unavailable");
+
+#if !defined(_WIN32)
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_MEMLOCK, &lim) == 0) {
+        if (lim.rlim_cur == RLIM_INFINITY)
+            Log::i("Memory lock limit: unlimited");
+        else
+            Log::i("Memory lock limit: %lu KiB", (unsigned long)(lim.rlim_cur / 1024));
+    }
+#if defined(RLIMIT_RTPRIO)
+    if (getrlimit(RLIMIT_RTPRIO, &lim) == 0) {
+        if (lim.rlim_cur == RLIM_INFINITY)
+            Log::i("Real-time priority limit: unlimited");
+        else
+            Log::i("Real-time priority limit: %lu", (unsigned long)lim.rlim_cur);
+    }
+#endif
+#endif
+
+    if (!realtime_enabled)
+        return;
+
+    Log::i("Enable real-time profile (priority %d)", realtime_priority);
+
+#if !defined(_WIN32)
+    memory_locked = lock_process_memory();
+#endif
+}
+
+bool realtime_profile_enabled()
+{
+    return realtime_enabled;
+}
+
+bool realtime_memory_locked_future()
+{
+    return memory_locked_future;
+}
+
+#if !defined(_WIN32)
+static bool set_posix_thread_priority(int policy, int priority)
+{
+    int min = sched_get_priority_min(policy);
+    int max = sched_get_priority_max(policy);
+    if (min == -1 || max == -1)
+        return false;
+
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = std::max(min, std::min(max, priority));
+    return pthread_setschedparam(pthread_self(), policy, &param) == 0;
+}
+#endif
+
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void prefault_stack()
+{
+    volatile char stack[stack_prefault_size];
+    for (size_t i = 0; i < stack_prefault_size; i += 64)
+        stack[i] = 0;
+    (void)stack[0];
+}
+
+void realtime_setup_thread(Realtime_Thread_Role role)
+{
+    if (role != Realtime_Thread_Player)
+        disable_denormals();
+
+    // the player also loads the synths and the files, which takes seconds
+    // of processing and I/O; under a real-time policy, this would starve the
+    // rest of the system, so it keeps the normal policy
+    if (!realtime_enabled || role == Realtime_Thread_Player)
+        return;
+
+    int priority = realtime_priority;
+
+    const char *role_name = "";
+    switch (role) {
+    case Realtime_Thread_Player: role_name = "player"; break;
+    case Realtime_Thread_Render: role_name = "render"; break;
+    case Realtime_Thread_Worker: role_name = "worker"; break;
+    }
+
+#if defined(_WIN32)
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+        Log::w("Cannot raise the priority of the %s thread", role_name);
+#else
+    if (set_posix_thread_priority(SCHED_FIFO, priority))
+        Log::i("Real-time %s thread: FIFO priority %d", role_name, priority);
+    else if (set_posix_thread_priority(SCHED_RR, priority))
+        Log::i("Real-time %s thread: RR priority %d", role_name, priority);
+    else
+        Log::w("Cannot set real-time priority of the %s thread, keep the default", role_name);
+#endif
+
+    if (memory_locked)
+        prefault_stack();
+}
+
+void disable_denormals() noexcept
+{
+    set_fp_control(with_denormals_disabled(get_fp_control()));
+}
+
+///
+Denormal_Guard::Denormal_Guard() noexcept
+    : saved_(get_fp_control())
+{
+    set_fp_control(with_denormals_disabled(saved_));
+}
+
+Denormal_Guard::~Denormal_Guard() noexcept
+{
+    set_fp_control(saved_);
+}
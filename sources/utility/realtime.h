@@ -0,0 +1,39 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+enum Realtime_Thread_Role {
+    Realtime_Thread_Player, // sequencing of MIDI events, at normal priority
+    Realtime_Thread_Render, // audio rendering in advance of the device
+    Realtime_Thread_Worker, // helper of the audio rendering
+};
+
+// reads the real-time profile from the global configuration, locks memory
+// if enabled, and reports what the system permits; call once at startup
+void realtime_initialize();
+bool realtime_profile_enabled();
+// whether new mappings are locked, and so read in full as they are made
+bool realtime_memory_locked_future();
+
+// applies the profile to the calling thread
+void realtime_setup_thread(Realtime_Thread_Role role);
+
+// flushes denormal numbers to zero on the calling thread, permanently
+void disable_denormals() noexcept;
+
+// flushes denormal numbers to zero on the calling thread, within a scope
+class Denormal_Guard {
+public:
+    Denormal_Guard() noexcept;
+    ~Denormal_Guard() noexcept;
+
+private:
+    Denormal_Guard(const Denormal_Guard &) = delete;
+    Denormal_Guard &operator=(const Denormal_Guard &) = delete;
+
+private:
+    unsigned long saved_ = 0;
+};
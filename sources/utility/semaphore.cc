@@ -0,0 +1,81 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "semaphore.h"
+#include <stdexcept>
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <cerrno>
+#endif
+
+#if defined(_WIN32)
+Semaphore::Semaphore(unsigned value)
+{
+    handle_ = CreateSemaphoreW(nullptr, (LONG)value, LONG_MAX, nullptr);
+    if (!handle_)
+        throw std::runtime_error("CreateSemaphore");
+}
+
+Semaphore::~Semaphore()
+{
+    CloseHandle((HANDLE)handle_);
+}
+
+void Semaphore::post()
+{
+    ReleaseSemaphore((HANDLE)handle_, 1, nullptr);
+}
+
+void Semaphore::wait()
+{
+    WaitForSingleObject((HANDLE)handle_, INFINITE);
+}
+#elif defined(__APPLE__)
+Semaphore::Semaphore(unsigned value)
+{
+    handle_ = dispatch_semaphore_create((long)value);
+    if (!handle_)
+        throw std::runtime_error("dispatch_semaphore_create");
+}
+
+Semaphore::~Semaphore()
+{
+    dispatch_release((dispatch_semaphore_t)handle_);
+}
+
+void Semaphore::post()
+{
+    dispatch_semaphore_signal((dispatch_semaphore_t)handle_);
+}
+
+void Semaphore::wait()
+{
+    dispatch_semaphore_wait((dispatch_semaphore_t)handle_, DISPATCH_TIME_FOREVER);
+}
+#else
+Semaphore::Semaphore(unsigned value)
+{
+    if (sem_init(&sem_, 0, value) != 0)
+        throw std::runtime_error("sem_init");
+}
+
+Semaphore::~Semaphore()
+{
+    sem_destroy(&sem_);
+}
+
+void Semaphore::post()
+{
+    sem_post(&sem_);
+}
+
+void Semaphore::wait()
+{
+    while (sem_wait(&sem_) == -1 && errno == EINTR);
+}
+#endif
@@ -0,0 +1,31 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <semaphore.h>
+#endif
+
+// A counting semaphore of the system, which a real-time thread can post to
+// without ever blocking, unlike the notification of a condition variable.
+class Semaphore {
+public:
+    explicit Semaphore(unsigned value = 0);
+    ~Semaphore();
+
+    void post();
+    void wait();
+
+private:
+    Semaphore(const Semaphore &) = delete;
+    Semaphore &operator=(const Semaphore &) = delete;
+
+private:
+#if defined(_WIN32) || defined(__APPLE__)
+    void *handle_ = nullptr;
+#else
+    sem_t sem_;
+#endif
+};
@@ -0,0 +1,119 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "task_graph.h"
+#include "utility/logs.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+Task_Graph::Task_Graph(unsigned thread_count)
+    : thread_count_(std::max(1u, thread_count))
+{
+}
+
+Task_Graph::~Task_Graph()
+{
+    wait_all();
+}
+
+auto Task_Graph::add_task(gsl::cstring_span name, std::function<void()> fn, std::initializer_list<Task_Id> deps) -> Task_Id
+{
+    assert(threads_.empty());
+
+    Task task;
+    task.name = gsl::to_string(name);
+    task.fn = std::move(fn);
+    task.deps.assign(deps.begin(), deps.end());
+    tasks_.push_back(std::move(task));
+    return tasks_.size() - 1;
+}
+
+void Task_Graph::start()
+{
+    unsigned count = std::min<unsigned>(thread_count_, (unsigned)tasks_.size());
+    threads_.reserve(count);
+    for (unsigned i = 0; i < count; ++i)
+        threads_.emplace_back([this] { thread_exec(); });
+}
+
+bool Task_Graph::is_done(Task_Id id) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_[id].done;
+}
+
+void Task_Graph::wait_all()
+{
+    for (std::thread &thread : threads_)
+        thread.join();
+    threads_.clear();
+}
+
+void Task_Graph::thread_exec()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        Task *next = nullptr;
+        bool pending = false;
+
+        for (Task &task : tasks_) {
+            if (task.started)
+                continue;
+            pending = true;
+            if (is_ready(task.deps)) {
+                next = &task;
+                break;
+            }
+        }
+
+        if (!pending)
+            return;
+
+        if (!next) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        next->started = true;
+        lock.unlock();
+
+        {
+            Phase_Timer timer(next->name.c_str());
+            try {
+                next->fn();
+            }
+            catch (std::exception &ex) {
+                Log::e("Startup task %s failed: %s", next->name.c_str(), ex.what());
+            }
+        }
+
+        lock.lock();
+        next->done = true;
+        cond_.notify_all();
+    }
+}
+
+bool Task_Graph::is_ready(const std::vector<Task_Id> &deps) const
+{
+    for (Task_Id dep : deps) {
+        if (!tasks_[dep].done)
+            return false;
+    }
+    return true;
+}
+
+///
+Phase_Timer::Phase_Timer(const char *name)
+    : name_(name), start_(std::chrono::steady_clock::now())
+{
+}
+
+Phase_Timer::~Phase_Timer()
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_;
+    Log::i("Startup phase %s: %.1f ms", name_, elapsed.count());
+}
@@ -0,0 +1,60 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <gsl/gsl>
+#include <functional>
+#include <initializer_list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// A set of tasks with dependencies, which run on background threads as soon
+// as the tasks they depend on have completed. Each task logs its duration.
+class Task_Graph {
+public:
+    explicit Task_Graph(unsigned thread_count);
+    ~Task_Graph();
+
+    typedef size_t Task_Id;
+
+    Task_Id add_task(gsl::cstring_span name, std::function<void()> fn, std::initializer_list<Task_Id> deps = {});
+    void start();
+    bool is_done(Task_Id id) const;
+    void wait_all();
+
+private:
+    void thread_exec();
+    bool is_ready(const std::vector<Task_Id> &deps) const;
+
+private:
+    struct Task {
+        std::string name;
+        std::function<void()> fn;
+        std::vector<Task_Id> deps;
+        bool started = false;
+        bool done = false;
+    };
+
+    unsigned thread_count_ = 0;
+    std::vector<Task> tasks_;
+    std::vector<std::thread> threads_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+// Logs the duration of a phase of the initialization, within a scope.
+class Phase_Timer {
+public:
+    explicit Phase_Timer(const char *name);
+    ~Phase_Timer();
+
+private:
+    const char *name_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,102 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "worker_pool.h"
+#include "realtime.h"
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+
+static constexpr unsigned job_index_bits = 24;
+static constexpr uint64_t job_index_mask = ((uint64_t)1 << job_index_bits) - 1;
+static constexpr uint32_t job_generation_mask = 0xffff;
+
+Worker_Pool::Worker_Pool(unsigned thread_count)
+{
+    threads_.reserve(thread_count);
+    for (unsigned i = 0; i < thread_count; ++i)
+        threads_.emplace_back([this] { thread_exec(); });
+}
+
+Worker_Pool::~Worker_Pool()
+{
+    quit_.store(true);
+    for (size_t i = 0; i < threads_.size(); ++i)
+        wake_.post();
+
+    for (std::thread &thread : threads_)
+        thread.join();
+}
+
+bool Worker_Pool::run(job_function_t *fn, void *user_data, size_t count, double deadline)
+{
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point start = clock::now();
+
+    assert(count <= job_index_mask);
+
+    // the workers have finished the previous batch, none reads these now
+    uint32_t generation = generation_ = (generation_ + 1) & job_generation_mask;
+    fn_.store(fn, std::memory_order_relaxed);
+    user_data_.store(user_data, std::memory_order_relaxed);
+    jobs_done_.store(0, std::memory_order_relaxed);
+    next_job_.store(((uint64_t)generation << (2 * job_index_bits)) |
+                    ((uint64_t)count << job_index_bits), std::memory_order_release);
+
+    // a worker for each job but the one of this thread
+    size_t wakes = std::min<size_t>(threads_.size(), count ? (count - 1) : 0);
+    for (size_t i = 0; i < wakes; ++i)
+        wake_.post();
+
+    for (size_t index; claim_job(generation, index);) {
+        fn(user_data, index);
+        jobs_done_.fetch_add(1, std::memory_order_release);
+    }
+
+    while (jobs_done_.load(std::memory_order_acquire) < count)
+        std::this_thread::yield();
+
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return elapsed.count() <= deadline;
+}
+
+void Worker_Pool::thread_exec()
+{
+    realtime_setup_thread(Realtime_Thread_Worker);
+
+    for (;;) {
+        wake_.wait();
+        if (quit_.load())
+            return;
+
+        // a wake-up may come after its batch is done, then nothing is claimed
+        uint32_t generation = (uint32_t)(next_job_.load(std::memory_order_acquire) >> (2 * job_index_bits));
+        job_function_t *fn = fn_.load(std::memory_order_relaxed);
+        void *user_data = user_data_.load(std::memory_order_relaxed);
+
+        for (size_t index; claim_job(generation, index);) {
+            fn(user_data, index);
+            jobs_done_.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
+
+bool Worker_Pool::claim_job(uint32_t generation, size_t &index)
+{
+    uint64_t next = next_job_.load(std::memory_order_acquire);
+
+    // the generation check ensures a late worker never claims a job of a
+    // batch other than the one it has picked up; as long as one of its jobs
+    // is unclaimed, the batch which it has read is still the current one
+    do {
+        if ((uint32_t)(next >> (2 * job_index_bits)) != generation)
+            return false;
+        if ((next & job_index_mask) >= ((next >> job_index_bits) & job_index_mask))
+            return false;
+    } while (!next_job_.compare_exchange_weak(next, next + 1, std::memory_order_acq_rel));
+
+    index = (size_t)(next & job_index_mask);
+    return true;
+}
@@ -0,0 +1,51 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "semaphore.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// A set of persistent threads which execute batches of jobs for the audio
+// thread. The caller participates in the batch, and it executes itself any
+// job which no worker has picked up yet, so a batch always completes even if
+// the workers are late to wake up. The audio thread publishes a batch with
+// atomics, and wakes the workers by a semaphore, it never waits on a lock.
+class Worker_Pool {
+public:
+    explicit Worker_Pool(unsigned thread_count);
+    ~Worker_Pool();
+
+    unsigned thread_count() const noexcept { return (unsigned)threads_.size(); }
+
+    typedef void (job_function_t)(void *user_data, size_t index);
+
+    // Runs the jobs of indices [0:count), and returns when all are finished.
+    // The count is less than 2^24.
+    // Returns false if the batch has completed later than the deadline (s).
+    bool run(job_function_t *fn, void *user_data, size_t count, double deadline);
+
+private:
+    void thread_exec();
+    bool claim_job(uint32_t generation, size_t &index);
+
+private:
+    std::vector<std::thread> threads_;
+    Semaphore wake_;
+    std::atomic<bool> quit_{false};
+
+    // the batch, valid for the generation which the next job has
+    uint32_t generation_ = 0;
+    std::atomic<job_function_t *> fn_{nullptr};
+    std::atomic<void *> user_data_{nullptr};
+
+    // generation in the high 16 bits, count of jobs in the middle 24 bits,
+    // and index of the next job in the low 24 bits
+    std::atomic<uint64_t> next_job_{0};
+    std::atomic<size_t> jobs_done_{0};
+};
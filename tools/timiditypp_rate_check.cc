@@ -0,0 +1,175 @@
+//          Copyright Jean Pierre Cimalando 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks that instances of the TiMidity++ plugin, which run at the same time
+// on threads of their own, two at the same rate and one at another, render
+// the same as each of them running alone.
+//
+// usage: timiditypp-rate-check <plugin module> <soundfont>
+
+#include "synth/synth.h"
+#include "utility/load_library.h"
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+
+static constexpr size_t block_frames = 256;
+static constexpr size_t total_blocks = 400;
+
+struct Rate_Check_Synth {
+    const synth_interface *intf = nullptr;
+    synth_object *obj = nullptr;
+    size_t block = 0;
+    std::vector<float> output;
+};
+
+static bool start_synth(Rate_Check_Synth &synth, const synth_interface *intf, double srate, const char *soundfont)
+{
+    synth.intf = intf;
+    synth.obj = intf->synth_instantiate(srate);
+    if (!synth.obj)
+        return false;
+
+    const char *soundfonts[] = {soundfont, nullptr};
+    synth_value value;
+    value.m = soundfonts;
+    intf->synth_set_option(synth.obj, "soundfont", value);
+
+    if (intf->synth_activate(synth.obj) != 0) {
+        intf->synth_cleanup(synth.obj);
+        synth.obj = nullptr;
+        return false;
+    }
+
+    synth.block = 0;
+    synth.output.clear();
+    synth.output.reserve(2 * block_frames * total_blocks);
+    return true;
+}
+
+static void stop_synth(Rate_Check_Synth &synth)
+{
+    synth.intf->synth_deactivate(synth.obj);
+    synth.intf->synth_cleanup(synth.obj);
+    synth.obj = nullptr;
+}
+
+// the same song for every synth, as notes of a few programs which overlap
+static void render_block(Rate_Check_Synth &synth)
+{
+    const synth_interface *intf = synth.intf;
+    size_t block = synth.block++;
+
+    if (block == 0) {
+        for (unsigned c = 0; c < 4; ++c) {
+            const unsigned char program[] = {(unsigned char)(0xc0 | c), (unsigned char)(c * 24)};
+            intf->synth_write(synth.obj, program, sizeof(program));
+        }
+    }
+
+    if (block % 50 == 0) {
+        unsigned c = (block / 50) % 4;
+        unsigned key = 48 + (block / 50) * 3 % 24;
+        const unsigned char note_on[] = {(unsigned char)(0x90 | c), (unsigned char)key, 100};
+        intf->synth_write(synth.obj, note_on, sizeof(note_on));
+    }
+    else if (block % 50 == 40) {
+        unsigned c = (block / 50) % 4;
+        unsigned key = 48 + (block / 50) * 3 % 24;
+        const unsigned char note_off[] = {(unsigned char)(0x80 | c), (unsigned char)key, 0};
+        intf->synth_write(synth.obj, note_off, sizeof(note_off));
+    }
+
+    float frames[2 * block_frames];
+    intf->synth_generate(synth.obj, frames, block_frames);
+    synth.output.insert(synth.output.end(), frames, frames + 2 * block_frames);
+}
+
+static bool render_alone(const synth_interface *intf, double srate, const char *soundfont, std::vector<float> &output)
+{
+    Rate_Check_Synth synth;
+    if (!start_synth(synth, intf, srate, soundfont))
+        return false;
+    for (size_t i = 0; i < total_blocks; ++i)
+        render_block(synth);
+    stop_synth(synth);
+    output = std::move(synth.output);
+    return true;
+}
+
+static bool same_output(const std::vector<float> &a, const std::vector<float> &b)
+{
+    return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(float));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <plugin module> <soundfont>\n", argv[0]);
+        return 2;
+    }
+
+    const char *module_path = argv[1];
+    const char *soundfont = argv[2];
+
+    Dl_Handle_U module(Dl_open(module_path));
+    if (!module) {
+        fprintf(stderr, "Cannot load the plugin module.\n");
+        return 2;
+    }
+
+    synth_plugin_entry_fn *entry = (synth_plugin_entry_fn *)Dl_sym(module.get(), "synth_plugin_entry");
+    const synth_interface *intf = entry ? entry() : nullptr;
+    if (!intf || intf->abi_version != SYNTH_ABI_VERSION) {
+        fprintf(stderr, "Cannot find a plugin of this version in the module.\n");
+        return 2;
+    }
+
+    intf->plugin_init("");
+
+    const unsigned count = 3;
+    const double rates[count] = {44100, 48000, 44100};
+    std::vector<float> alone[count];
+    for (unsigned i = 0; i < count; ++i) {
+        if (!render_alone(intf, rates[i], soundfont, alone[i])) {
+            fprintf(stderr, "Cannot start the synth at %g Hz.\n", rates[i]);
+            return 2;
+        }
+    }
+
+    // each on a thread of its own, like the parts of a parallel synth, so the
+    // calls of the two rates contend with each other
+    Rate_Check_Synth together[count];
+    for (unsigned i = 0; i < count; ++i) {
+        if (!start_synth(together[i], intf, rates[i], soundfont)) {
+            fprintf(stderr, "Cannot start the synth at %g Hz.\n", rates[i]);
+            return 2;
+        }
+    }
+    std::thread threads[count];
+    for (unsigned i = 0; i < count; ++i) {
+        Rate_Check_Synth *synth = &together[i];
+        threads[i] = std::thread([synth] {
+            for (size_t b = 0; b < total_blocks; ++b)
+                render_block(*synth);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    for (unsigned i = 0; i < count; ++i)
+        stop_synth(together[i]);
+
+    intf->plugin_shutdown();
+
+    bool success = true;
+    for (unsigned i = 0; i < count; ++i) {
+        bool same = same_output(alone[i], together[i].output);
+        fprintf(stderr, "Synth %u at %g Hz: %s\n", i + 1, rates[i], same ? "identical" : "DIFFERENT");
+        success = success && same;
+    }
+
+    return success ? 0 : 1;
+}